@@ -6,6 +6,9 @@
 #include "lvio_fusion/frame.h"
 #include "lvio_fusion/imu/initializer.h"
 #include "lvio_fusion/lidar/mapping.h"
+#include "lvio_fusion/loop/pose_graph.h"
+#include "lvio_fusion/map_file.h"
+#include "lvio_fusion/trajectory.h"
 
 #include <ceres/ceres.h>
 
@@ -13,6 +16,7 @@ namespace lvio_fusion
 {
 
 class Frontend;
+class LoopDetector;
 
 enum class BackendStatus
 {
@@ -34,8 +38,18 @@ public:
 
     void SetInitializer(Initializer::Ptr initializer) { initializer_ = initializer; }
 
+    void SetPoseGraph(PoseGraph::Ptr pose_graph) { pose_graph_ = pose_graph; }
+
+    void SetLoopDetector(std::shared_ptr<LoopDetector> detector) { detector_ = detector; }
+
+    void SetMapWriter(MapWriter::Ptr map_writer) { map_writer_ = map_writer; }
+
+    void SetTrajectory(Trajectory::Ptr trajectory) { trajectory_ = trajectory; }
+
     void UpdateMap();
 
+    void ApplyCorrections();
+
     void Pause();
 
     void Continue();
@@ -58,6 +72,10 @@ private:
     std::weak_ptr<Frontend> frontend_;
     Mapping::Ptr mapping_;
     Initializer::Ptr initializer_;
+    PoseGraph::Ptr pose_graph_;
+    std::weak_ptr<LoopDetector> detector_;
+    MapWriter::Ptr map_writer_;
+    Trajectory::Ptr trajectory_;
 
     std::thread thread_;
     std::mutex running_mutex_, pausing_mutex_;
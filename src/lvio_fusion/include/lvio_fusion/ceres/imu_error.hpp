@@ -9,10 +9,32 @@
 namespace lvio_fusion
 {
 
+/**
+ * jacobian w.r.t. the global parameters [qx, qy, qz, qw, tx, ty, tz] from the one w.r.t. the right perturbation,
+ * Q = Q * exp(phi), P = P + t, valid for any local parameterization of unit quaternions
+ * @param Q             rotation of the pose
+ * @param J_phi         jacobian w.r.t. phi
+ * @param J_t           jacobian w.r.t. t
+ * @param jacobian      output, row major
+ */
+inline void pose_jacobian(const Quaterniond &Q, const Matrix<double, 15, 3> &J_phi, const Matrix<double, 15, 3> &J_t, double *jacobian)
+{
+    // d(Q * exp(phi)) / d(phi) = 0.5 * L(Q) * [I; 0], in the order of [x, y, z, w]
+    Matrix<double, 4, 3> L;
+    L.topRows<3>() = Q.w() * Matrix3d::Identity() + skew_symmetric(Q.vec());
+    L.bottomRows<1>() = -Q.vec().transpose();
+    Eigen::Map<Matrix<double, 15, 7, RowMajor>> J(jacobian);
+    J.leftCols<4>() = 2 * J_phi * L.transpose();
+    J.rightCols<3>() = J_t;
+}
+
 class ImuError : public ceres::SizedCostFunction<15, 7, 3, 3, 3, 7, 3, 3, 3>
 {
 public:
-    ImuError(imu::Preintegration::Ptr preintegration) : preintegration_(preintegration) {}
+    ImuError(imu::Preintegration::Ptr preintegration) : preintegration_(preintegration)
+    {
+        sqrt_info_ = LLT<Matrix<double, 15, 15>>(preintegration_->covariance.inverse()).matrixL().transpose();
+    }
 
     virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
     {
@@ -32,29 +54,26 @@ public:
 
         Eigen::Map<Matrix<double, 15, 1>> residual(residuals);
         residual = preintegration_->Evaluate(Pi, Qi, Vi, Bai, Bgi, Pj, Qj, Vj, Baj, Bgj);
-        Matrix<double, 15, 15> sqrt_info = LLT<Matrix<double, 15, 15>>(preintegration_->covariance.inverse()).matrixL().transpose();
-        residual = sqrt_info * residual;
-        LOG(INFO) << residual;
-        
+        residual = sqrt_info_ * residual;
+
         if (jacobians)
         {
             double sum_dt = preintegration_->sum_dt;
-            Matrix3d dp_dba = preintegration_->jacobian.template block<3, 3>(imu::O_T, imu::O_BA);
-            Matrix3d dp_dbg = preintegration_->jacobian.template block<3, 3>(imu::O_T, imu::O_BG);
-            Matrix3d dq_dbg = preintegration_->jacobian.template block<3, 3>(imu::O_R, imu::O_BG);
-            Matrix3d dv_dba = preintegration_->jacobian.template block<3, 3>(imu::O_V, imu::O_BA);
-            Matrix3d dv_dbg = preintegration_->jacobian.template block<3, 3>(imu::O_V, imu::O_BG);
+            Matrix3d dp_dba = preintegration_->dp_dba();
+            Matrix3d dp_dbg = preintegration_->dp_dbg();
+            Matrix3d dq_dbg = preintegration_->dq_dbg();
+            Matrix3d dv_dba = preintegration_->dv_dba();
+            Matrix3d dv_dbg = preintegration_->dv_dbg();
+            Quaterniond corrected_delta_q = preintegration_->delta_q * q_delta(dq_dbg * (Bgi - preintegration_->linearized_bg));
 
             if (jacobians[0])
             {
-                Eigen::Map<Matrix<double, 15, 7, RowMajor>> jacobian_pose_i(jacobians[0]);
-                jacobian_pose_i.setZero();
-                jacobian_pose_i.block<3, 3>(imu::O_T, imu::O_PT) = -Qi.inverse().toRotationMatrix();
-                jacobian_pose_i.block<3, 3>(imu::O_T, imu::O_PR) = skew_symmetric(Qi.inverse() * (0.5 * imu::g * sum_dt * sum_dt + Pj - Pi - Vi * sum_dt));
-                Quaterniond corrected_delta_q = preintegration_->delta_q * q_delta(dq_dbg * (Bgi - preintegration_->linearized_bg));
-                jacobian_pose_i.block<3, 3>(imu::O_R, imu::O_PR) = -(q_left(Qj.inverse() * Qi) * q_right(corrected_delta_q)).bottomRightCorner<3, 3>();
-                jacobian_pose_i.block<3, 3>(imu::O_V, imu::O_PR) = skew_symmetric(Qi.inverse() * (imu::g * sum_dt + Vj - Vi));
-                jacobian_pose_i = sqrt_info * jacobian_pose_i;
+                Matrix<double, 15, 3> J_phi = Matrix<double, 15, 3>::Zero(), J_t = Matrix<double, 15, 3>::Zero();
+                J_t.block<3, 3>(imu::O_T, 0) = -Qi.inverse().toRotationMatrix();
+                J_phi.block<3, 3>(imu::O_T, 0) = skew_symmetric(Qi.inverse() * (0.5 * imu::g * sum_dt * sum_dt + Pj - Pi - Vi * sum_dt));
+                J_phi.block<3, 3>(imu::O_R, 0) = -(q_left(Qj.inverse() * Qi) * q_right(corrected_delta_q)).bottomRightCorner<3, 3>();
+                J_phi.block<3, 3>(imu::O_V, 0) = skew_symmetric(Qi.inverse() * (imu::g * sum_dt + Vj - Vi));
+                pose_jacobian(Qi, sqrt_info_ * J_phi, sqrt_info_ * J_t, jacobians[0]);
             }
             if (jacobians[1])
             {
@@ -62,7 +81,7 @@ public:
                 jacobian_v_i.setZero();
                 jacobian_v_i.block<3, 3>(imu::O_T, 0) = -Qi.inverse().toRotationMatrix() * sum_dt;
                 jacobian_v_i.block<3, 3>(imu::O_V, 0) = -Qi.inverse().toRotationMatrix();
-                jacobian_v_i = sqrt_info * jacobian_v_i;
+                jacobian_v_i = sqrt_info_ * jacobian_v_i;
             }
             if (jacobians[2])
             {
@@ -71,7 +90,7 @@ public:
                 jacobian_ba_i.block<3, 3>(imu::O_T, 0) = -dp_dba;
                 jacobian_ba_i.block<3, 3>(imu::O_V, 0) = -dv_dba;
                 jacobian_ba_i.block<3, 3>(imu::O_BA, 0) = -Matrix3d::Identity();
-                jacobian_ba_i = sqrt_info * jacobian_ba_i;
+                jacobian_ba_i = sqrt_info_ * jacobian_ba_i;
             }
             if (jacobians[3])
             {
@@ -81,37 +100,35 @@ public:
                 jacobian_bg_i.block<3, 3>(imu::O_R, 0) = -q_left(Qj.inverse() * Qi * preintegration_->delta_q).bottomRightCorner<3, 3>() * dq_dbg;
                 jacobian_bg_i.block<3, 3>(imu::O_V, 0) = -dv_dbg;
                 jacobian_bg_i.block<3, 3>(imu::O_BG, 0) = -Matrix3d::Identity();
-                jacobian_bg_i = sqrt_info * jacobian_bg_i;
+                jacobian_bg_i = sqrt_info_ * jacobian_bg_i;
             }
             if (jacobians[4])
             {
-                Eigen::Map<Matrix<double, 15, 7, RowMajor>> jacobian_pose_j(jacobians[4]);
-                jacobian_pose_j.setZero();
-                jacobian_pose_j.block<3, 3>(imu::O_T, imu::O_PT) = Qi.inverse().toRotationMatrix();
-                Quaterniond corrected_delta_q = preintegration_->delta_q * q_delta(dq_dbg * (Bgi - preintegration_->linearized_bg));
-                jacobian_pose_j.block<3, 3>(imu::O_R, imu::O_PR) = q_left(corrected_delta_q.inverse() * Qi.inverse() * Qj).bottomRightCorner<3, 3>();
-                jacobian_pose_j = sqrt_info * jacobian_pose_j;
+                Matrix<double, 15, 3> J_phi = Matrix<double, 15, 3>::Zero(), J_t = Matrix<double, 15, 3>::Zero();
+                J_t.block<3, 3>(imu::O_T, 0) = Qi.inverse().toRotationMatrix();
+                J_phi.block<3, 3>(imu::O_R, 0) = q_left(corrected_delta_q.inverse() * Qi.inverse() * Qj).bottomRightCorner<3, 3>();
+                pose_jacobian(Qj, sqrt_info_ * J_phi, sqrt_info_ * J_t, jacobians[4]);
             }
             if (jacobians[5])
             {
                 Eigen::Map<Matrix<double, 15, 3, RowMajor>> jacobian_v_j(jacobians[5]);
                 jacobian_v_j.setZero();
                 jacobian_v_j.block<3, 3>(imu::O_V, 0) = Qi.inverse().toRotationMatrix();
-                jacobian_v_j = sqrt_info * jacobian_v_j;
+                jacobian_v_j = sqrt_info_ * jacobian_v_j;
             }
             if (jacobians[6])
             {
                 Eigen::Map<Matrix<double, 15, 3, RowMajor>> jacobian_ba_j(jacobians[6]);
                 jacobian_ba_j.setZero();
                 jacobian_ba_j.block<3, 3>(imu::O_BA, 0) = Matrix3d::Identity();
-                jacobian_ba_j = sqrt_info * jacobian_ba_j;
+                jacobian_ba_j = sqrt_info_ * jacobian_ba_j;
             }
             if (jacobians[7])
             {
                 Eigen::Map<Matrix<double, 15, 3, RowMajor>> jacobian_bg_j(jacobians[7]);
                 jacobian_bg_j.setZero();
                 jacobian_bg_j.block<3, 3>(imu::O_BG, 0) = Matrix3d::Identity();
-                jacobian_bg_j = sqrt_info * jacobian_bg_j;
+                jacobian_bg_j = sqrt_info_ * jacobian_bg_j;
             }
         }
         return true;
@@ -124,6 +141,7 @@ public:
 
 private:
     imu::Preintegration::Ptr preintegration_;
+    Matrix<double, 15, 15> sqrt_info_;
 };
 } // namespace lvio_fusion
 
@@ -7,45 +7,93 @@
 namespace lvio_fusion
 {
 
-class PoseGraphError
+/**
+ * SE3 pose on the se(3) tangent space, T = T * exp(delta)
+ * global parameters are SE3d::data(), [qx, qy, qz, qw, tx, ty, tz]
+ * local parameters are [rho, phi] in the order of Sophus::SE3d::log()
+ */
+class SE3Parameterization : public ceres::LocalParameterization
+{
+public:
+    virtual bool Plus(const double *x, const double *delta, double *x_plus_delta) const
+    {
+        Eigen::Map<const SE3d> T(x);
+        Eigen::Map<const Vector6d> d(delta);
+        Eigen::Map<SE3d> T_plus_delta(x_plus_delta);
+        T_plus_delta = T * SE3d::exp(d);
+        return true;
+    }
+
+    // cost functions put the tangent jacobian in the first 6 columns
+    virtual bool ComputeJacobian(const double *x, double *jacobian) const
+    {
+        Eigen::Map<Matrix<double, 7, 6, RowMajor>> J(jacobian);
+        J.setZero();
+        J.topRows<6>().setIdentity();
+        return true;
+    }
+
+    virtual int GlobalSize() const { return SE3d::num_parameters; }
+
+    virtual int LocalSize() const { return SE3d::DoF; }
+};
+
+/**
+ * relative pose error with analytic jacobians, r = log(T_ij^-1 * Twc1^-1 * Twc2)
+ * only valid with SE3Parameterization
+ */
+class PoseGraphError : public ceres::SizedCostFunction<6, 7, 7>
 {
 public:
     PoseGraphError(SE3d last_frame, SE3d frame, double *weights)
+        : relative_inverse_((last_frame.inverse() * frame).inverse())
     {
-        se32rpyxyz(frame * last_frame.inverse(), rpyxyz_);
-        weights_[0] = weights[0];
-        weights_[1] = weights[1];
-        weights_[2] = weights[2];
-        weights_[3] = weights[3];
-        weights_[4] = weights[4];
-        weights_[5] = weights[5];
+        weights_ << weights[3], weights[4], weights[5], weights[0], weights[1], weights[2];
     }
 
-    template <typename T>
-    bool operator()(const T *Twc1, const T *Twc2, T *residuals) const
+    virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
     {
-        T relative_i_j[7], Twc1_inverse[7], rpyxyz[6];
-        ceres::SE3Inverse(Twc1, Twc1_inverse);
-        ceres::SE3Product(Twc2, Twc1_inverse, relative_i_j);
-        ceres::SE3ToRpyxyz(relative_i_j, rpyxyz);
-        residuals[0] = T(weights_[0]) * T(0); //(rpyxyz[0] - rpyxyz_[0]);
-        residuals[1] = T(weights_[1]) * T(0); //(rpyxyz[1] - rpyxyz_[1]);
-        residuals[2] = T(weights_[2]) * T(0); //(rpyxyz[2] - rpyxyz_[2]);
-        residuals[3] = T(weights_[3]) * (rpyxyz[3] - rpyxyz_[3]);
-        residuals[4] = T(weights_[4]) * (rpyxyz[4] - rpyxyz_[4]);
-        residuals[5] = T(weights_[5]) * (rpyxyz[5] - rpyxyz_[5]);
+        Eigen::Map<const SE3d> Twc1(parameters[0]);
+        Eigen::Map<const SE3d> Twc2(parameters[1]);
+        SE3d relative_i_j = Twc1.inverse() * Twc2;
+        Vector6d r = (relative_inverse_ * relative_i_j).log();
+        Eigen::Map<Vector6d> residual(residuals);
+        residual = weights_.asDiagonal() * r;
+
+        if (jacobians)
+        {
+            // J_r^-1(r) ~= I + 0.5 * ad(r)
+            Matrix6d Jr_inv = Matrix6d::Identity();
+            Matrix3d phi_hat = SO3d::hat(r.tail<3>());
+            Jr_inv.block<3, 3>(0, 0) += 0.5 * phi_hat;
+            Jr_inv.block<3, 3>(0, 3) += 0.5 * SO3d::hat(r.head<3>());
+            Jr_inv.block<3, 3>(3, 3) += 0.5 * phi_hat;
+            Jr_inv = weights_.asDiagonal() * Jr_inv;
+
+            if (jacobians[0])
+            {
+                Eigen::Map<Matrix<double, 6, 7, RowMajor>> J(jacobians[0]);
+                J.setZero();
+                J.leftCols<6>() = -Jr_inv * relative_i_j.inverse().Adj();
+            }
+            if (jacobians[1])
+            {
+                Eigen::Map<Matrix<double, 6, 7, RowMajor>> J(jacobians[1]);
+                J.setZero();
+                J.leftCols<6>() = Jr_inv;
+            }
+        }
         return true;
     }
 
     static ceres::CostFunction *Create(SE3d last_frame, SE3d frame, double *weights)
     {
-        return (new ceres::AutoDiffCostFunction<PoseGraphError, 6, 7, 7>(
-            new PoseGraphError(last_frame, frame, weights)));
+        return new PoseGraphError(last_frame, frame, weights);
     }
 
 private:
-    double rpyxyz_[6];
-    double weights_[6];
+    SE3d relative_inverse_;
+    Vector6d weights_;
 };
 
 class PoseError
@@ -26,16 +26,39 @@ using namespace Eigen;
 
 typedef Sophus::SE3d SE3d;
 typedef Sophus::SO3d SO3d;
+typedef Matrix<double, 6, 1> Vector6d;
+typedef Matrix<double, 6, 6> Matrix6d;
 
 // opencv
 #include <opencv2/opencv.hpp>
 
-// PCL
+// PCL, PCL_NO_PRECOMPILE is required by the custom point type
 #include <pcl/common/common_headers.h>
+#include <pcl/point_types.h>
 
-typedef pcl::PointXYZ Point3;
-typedef typename pcl::PointCloud<Point3> Point3Cloud;
-typedef pcl::PointXYZI PointI;
+// lidar point, ring and time are separate fields instead of being encoded in intensity
+struct EIGEN_ALIGN16 PointXYZIRT
+{
+    PCL_ADD_POINT4D;  // x, y, z, aligned for sse
+    float intensity;  // raw intensity of the lidar
+    float time;       // time offset in the sweep
+    uint16_t ring;    // row in the range image
+
+    // fields which are not loaded, e.g. time and ring of points read from map files, are zero
+    inline PointXYZIRT()
+    {
+        x = y = z = 0;
+        data[3] = 1;
+        intensity = time = 0;
+        ring = 0;
+    }
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(PointXYZIRT,
+                                  (float, x, x)(float, y, y)(float, z, z)(float, intensity, intensity)(float, time, time)(uint16_t, ring, ring))
+
+typedef PointXYZIRT PointI;
 typedef typename pcl::PointCloud<PointI> PointICloud;
 typedef pcl::PointXYZRGB PointRGB;
 typedef typename pcl::PointCloud<PointRGB> PointRGBCloud;
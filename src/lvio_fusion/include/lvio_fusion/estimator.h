@@ -12,6 +12,7 @@
 #include "lvio_fusion/loop/pose_graph.h"
 #include "lvio_fusion/navsat/navsat.h"
 #include "lvio_fusion/semantic/detected_object.h"
+#include "lvio_fusion/trajectory.h"
 
 namespace lvio_fusion
 {
@@ -39,7 +40,7 @@ public:
 
     void InputNavSat(double time, double latitude, double longitude, double altitude, double posAccuracy);
 
-    void InputPointCloud(double time, Point3Cloud::Ptr point_cloud);
+    void InputPointCloud(double time, PointICloud::Ptr point_cloud, bool has_time = false, bool has_ring = false);
 
     void InputIMU(double time, Vector3d acc, Vector3d gyr);
 
@@ -48,15 +49,24 @@ public:
     Frontend::Ptr frontend;
     Backend::Ptr backend;
     LoopDetector::Ptr detector;
+    DescriptorExtractor::Ptr extractor;
     FeatureAssociation::Ptr association;
     Mapping::Ptr mapping;
     Initializer::Ptr initializer;
+    imu::Integrator::Ptr integrator;
+    imu::Propagator::Ptr propagator;
     PoseGraph::Ptr pose_graph;
+    MapWriter::Ptr map_writer;
+    Trajectory::Ptr trajectory;
 
     int flags = Flag::None;
 
 private:
+    void LoadMap(double time);
+
     std::string config_file_path_;
+    std::string map_path_;
+    MapReader::Ptr map_reader_; // the saved map, loaded when the first frame arrives
 };
 } // namespace lvio_fusion
 
@@ -35,13 +35,13 @@ public:
     double time;
     cv::Mat image_left, image_right;
     std::vector<DetectedObject> objects;
-    visual::Features features_left;          // extracted features in left image
-    visual::Features features_right;         // corresponding features in right image, only for this frame
-    lidar::Feature::Ptr feature_lidar;       // extracted features in lidar point cloud
-    imu::Preintegration::Ptr preintegration; // imu pre integration
-    navsat::Feature::Ptr feature_navsat;     // navsat point
-    cv::Mat descriptors;                     // orb descriptors
-    loop::LoopClosure::Ptr loop_closure;     // loop closure
+    visual::Features features_left;               // extracted features in left image
+    visual::Features features_right;              // corresponding features in right image, only for this frame
+    lidar::Feature::Ptr feature_lidar;            // extracted features in lidar point cloud
+    imu::Preintegration::Ptr preintegration;      // imu pre integration
+    navsat::Feature::Ptr feature_navsat;          // navsat point
+    std::map<unsigned long, cv::Mat> descriptors; // orb descriptors, key is the id of landmark
+    loop::LoopClosure::Ptr loop_closure;          // loop closure
     Weights weights;
     SE3d pose;
 
@@ -4,6 +4,11 @@
 #include "lvio_fusion/common.h"
 #include "lvio_fusion/frame.h"
 #include "lvio_fusion/imu/initializer.h"
+#include "lvio_fusion/imu/integrator.h"
+#include "lvio_fusion/imu/propagator.h"
+#include "lvio_fusion/visual/extractor.h"
+
+#include <deque>
 
 namespace lvio_fusion
 {
@@ -29,10 +34,14 @@ public:
 
     bool AddFrame(Frame::Ptr frame);
 
-    void AddImu(double time, Vector3d acc, Vector3d gyr);
-
     void SetBackend(std::shared_ptr<Backend> backend) { backend_ = backend; }
 
+    void SetDescriptorExtractor(DescriptorExtractor::Ptr extractor) { extractor_ = extractor; }
+
+    void SetImuIntegrator(imu::Integrator::Ptr integrator) { integrator_ = integrator; }
+
+    void SetPropagator(imu::Propagator::Ptr propagator) { propagator_ = propagator; }
+
     void UpdateCache();
 
     FrontendStatus status = FrontendStatus::BUILDING;
@@ -45,9 +54,15 @@ public:
 private:
     bool Track();
 
+    void Preintegrate();
+
+    bool Velocity(double time, Vector3d &velocity);
+
+    void UpdatePropagator();
+
     bool Reset();
 
-    int TrackLastFrame();
+    int TrackLastFrame(bool imu_prior);
 
     void CreateKeyframe(bool need_new_features = true);
 
@@ -59,15 +74,27 @@ private:
 
     // data
     std::weak_ptr<Backend> backend_;
+    DescriptorExtractor::Ptr extractor_;
+    imu::Integrator::Ptr integrator_;
+    imu::Propagator::Ptr propagator_;
     std::unordered_map<unsigned long, Vector3d> position_cache_;
     SE3d last_frame_pose_cache_;
 
+    struct Segment
+    {
+        Frame::Ptr start, end;
+        Frame::Ptr key_frame; // the keyframe whose preintegration the segment is merged into
+    };
+    std::deque<Segment> pending_segments_; // segments waiting for imu data
+    Frame::Ptr last_segment_key_frame_;     // the keyframe whose preintegration ends at the last integrated segment
+
     // params
     int num_features_;
     int num_features_init_;
     int num_features_tracking_;
     int num_features_tracking_bad_;
     int num_features_needed_for_keyframe_;
+    const size_t max_pending_segments_ = 100;
 };
 
 } // namespace lvio_fusion
@@ -12,9 +12,11 @@ class Imu : public Sensor
 public:
     typedef std::shared_ptr<Imu> Ptr;
 
-    static int Create(const SE3d &extrinsic)
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    static int Create(const SE3d &extrinsic, double acc_n, double acc_w, double gyr_n, double gyr_w)
     {
-        devices_.push_back(Imu::Ptr(new Imu(extrinsic)));
+        devices_.push_back(Imu::Ptr(new Imu(extrinsic, acc_n, acc_w, gyr_n, gyr_w)));
         return devices_.size() - 1;
     }
 
@@ -30,10 +32,21 @@ public:
 
     double ACC_N, ACC_W;
     double GYR_N, GYR_W;
+    Matrix<double, 18, 18> noise; // noise model shared by all preintegrations
     bool initialized = false;
 
 private:
-    Imu(const SE3d &extrinsic) : Sensor(extrinsic) {}
+    Imu(const SE3d &extrinsic, double acc_n, double acc_w, double gyr_n, double gyr_w)
+        : Sensor(extrinsic), ACC_N(acc_n), ACC_W(acc_w), GYR_N(gyr_n), GYR_W(gyr_w)
+    {
+        noise = Matrix<double, 18, 18>::Zero();
+        noise.block<3, 3>(0, 0) = (ACC_N * ACC_N) * Matrix3d::Identity();
+        noise.block<3, 3>(3, 3) = (GYR_N * GYR_N) * Matrix3d::Identity();
+        noise.block<3, 3>(6, 6) = (ACC_N * ACC_N) * Matrix3d::Identity();
+        noise.block<3, 3>(9, 9) = (GYR_N * GYR_N) * Matrix3d::Identity();
+        noise.block<3, 3>(12, 12) = (ACC_W * ACC_W) * Matrix3d::Identity();
+        noise.block<3, 3>(15, 15) = (GYR_W * GYR_W) * Matrix3d::Identity();
+    }
     Imu(const Imu &);
     Imu &operator=(const Imu &);
 
@@ -14,7 +14,7 @@ public:
     typedef std::shared_ptr<Initializer> Ptr;
 
     bool Initialize(Frames kfs);
-    
+
     bool initialized = false;
     int num_frames = 10;
 
@@ -22,21 +22,17 @@ public:
     {
     public:
         imu::Preintegration::Ptr preintegration;
-        Matrix3d R;
-        Vector3d T;
+        Matrix3d R; // Rwb
+        Vector3d T; // twb
         Vector3d Ba, Bg;
     };
 
 private:
-    bool VisualInitialAlign();
-
     void SolveGyroscopeBias(std::vector<Initializer::Frame> &frames);
 
-    // void RefineGravity(VectorXd &x);
-
-    // bool LinearAlignment(VectorXd &x);
+    bool LinearAlignment(std::vector<Initializer::Frame> &frames, VectorXd &x);
 
-    // bool VisualIMUAlignment(VectorXd &x);
+    void RefineGravity(std::vector<Initializer::Frame> &frames, VectorXd &x);
 
     Vector3d g_;
 };
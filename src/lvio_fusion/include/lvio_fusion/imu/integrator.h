@@ -0,0 +1,46 @@
+#ifndef lvio_fusion_INTEGRATOR_H
+#define lvio_fusion_INTEGRATOR_H
+
+#include "lvio_fusion/common.h"
+#include "lvio_fusion/imu/preintegration.h"
+
+#include <deque>
+
+namespace lvio_fusion
+{
+
+namespace imu
+{
+
+struct Measurement
+{
+    double time;
+    Vector3d acc;
+    Vector3d gyr;
+};
+
+// integrate every imu sample only once, independent of the frontend
+class Integrator
+{
+public:
+    typedef std::shared_ptr<Integrator> Ptr;
+
+    Integrator(size_t capacity) : capacity_(capacity) {}
+
+    void AddImu(double time, const Vector3d &acc, const Vector3d &gyr);
+
+    Preintegration::Ptr Integrate(double start, double end, const Vector3d &v0, const Vector3d &ba, const Vector3d &bg);
+
+private:
+    Measurement Interpolate(double time);
+
+    std::mutex mutex_;
+    std::deque<Measurement, Eigen::aligned_allocator<Measurement>> buf_; // timestamped ring buffer
+    const size_t capacity_;
+};
+
+} // namespace imu
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_INTEGRATOR_H
@@ -11,30 +11,46 @@ class Frame;
 namespace imu
 {
 
-extern int O_T, O_R, O_V, O_BA, O_BG, O_PR, O_PT;
+extern int O_T, O_R, O_V, O_BA, O_BG;
 extern Vector3d g;
 
+struct Sample
+{
+    double dt;
+    Vector3d acc;
+    Vector3d gyr;
+};
+
+typedef std::vector<Sample, Eigen::aligned_allocator<Sample>> Samples;
+
 class Preintegration
 {
 public:
     typedef std::shared_ptr<Preintegration> Ptr;
 
-    static Preintegration::Ptr Create(const Vector3d &_acc_0, const Vector3d &_gyr_0, const Vector3d &_v0, const Vector3d &_linearized_ba, const Vector3d &_linearized_bg)
-    {
-        Preintegration::Ptr new_preintegration(new Preintegration(_acc_0, _gyr_0, _v0, _linearized_ba, _linearized_bg));
-        return new_preintegration;
-    }
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    static Preintegration::Ptr Create(const Vector3d &_acc_0, const Vector3d &_gyr_0, const Vector3d &_v0, const Vector3d &_linearized_ba, const Vector3d &_linearized_bg);
 
     void Append(double dt, const Vector3d &acc, const Vector3d &gyr)
     {
-        dt_buf.push_back(dt);
-        acc_buf.push_back(acc);
-        gyr_buf.push_back(gyr);
+        buf.push_back({dt, acc, gyr});
         Propagate(dt, acc, gyr);
     }
 
+    void Merge(Preintegration::Ptr next);
+
     void Repropagate(const Vector3d &_linearized_ba, const Vector3d &_linearized_bg);
 
+    void Correct(const Vector3d &_linearized_ba, const Vector3d &_linearized_bg);
+
+    // jacobians of delta_p, delta_q, delta_v w.r.t. biases
+    Matrix3d dp_dba() const { return jacobian.block<3, 3>(O_T, O_BA); }
+    Matrix3d dp_dbg() const { return jacobian.block<3, 3>(O_T, O_BG); }
+    Matrix3d dq_dbg() const { return jacobian.block<3, 3>(O_R, O_BG); }
+    Matrix3d dv_dba() const { return jacobian.block<3, 3>(O_V, O_BA); }
+    Matrix3d dv_dbg() const { return jacobian.block<3, 3>(O_V, O_BG); }
+
     void MidPointIntegration(double _dt,
                              const Vector3d &_acc_0, const Vector3d &_gyr_0,
                              const Vector3d &_acc_1, const Vector3d &_gyr_1,
@@ -56,21 +72,24 @@ public:
     Matrix<double, 15, 15> jacobian, covariance;
     Matrix<double, 15, 15> step_jacobian;
     Matrix<double, 15, 18> step_V;
-    Matrix<double, 18, 18> noise;
     double sum_dt;
     Vector3d delta_p;
     Quaterniond delta_q;
     Vector3d delta_v;
-    Vector3d v0;
+    Vector3d v0;     // velocity of the start frame in the world frame, optimized by the backend
+    Vector3d ba, bg; // biases of the start frame, optimized by the backend
 
-    std::vector<double> dt_buf;
-    std::vector<Vector3d> acc_buf;
-    std::vector<Vector3d> gyr_buf;
+    Samples buf;
 
 private:
+    Vector3d repropagated_ba_, repropagated_bg_; // biases used to integrate buf
+
     Preintegration() = default;
-    Preintegration(const Vector3d &_acc_0, const Vector3d &_gyr_0, const Vector3d &_v0,
-                   const Vector3d &_linearized_ba, const Vector3d &_linearized_bg);
+
+    void Reset(const Vector3d &_acc_0, const Vector3d &_gyr_0, const Vector3d &_v0,
+               const Vector3d &_linearized_ba, const Vector3d &_linearized_bg);
+
+    static void Recycle(Preintegration *preintegration);
 };
 
 typedef std::map<double, Preintegration::Ptr> PreIntegrations;
@@ -0,0 +1,72 @@
+#ifndef lvio_fusion_PROPAGATOR_H
+#define lvio_fusion_PROPAGATOR_H
+
+#include "lvio_fusion/common.h"
+#include "lvio_fusion/imu/integrator.h"
+
+#include <chrono>
+#include <deque>
+#include <functional>
+
+namespace lvio_fusion
+{
+
+namespace imu
+{
+
+struct Odometry
+{
+    double time;       // timestamp of the newest measurement
+    SE3d pose;         // Twc
+    Vector3d velocity; // in the world frame
+    double latency;    // seconds from the input of the measurement to the output
+    double age;        // seconds propagated from the last visual state
+};
+
+// propagate the latest visual state with imu samples, and output poses at imu rate
+class Propagator
+{
+public:
+    typedef std::shared_ptr<Propagator> Ptr;
+    typedef std::function<void(const Odometry &)> Callback;
+
+    Propagator(size_t capacity) : capacity_(capacity) {}
+
+    void Subscribe(Callback callback);
+
+    void SetState(double time, const SE3d &pose, const Vector3d &ba, const Vector3d &bg, const Vector3d *velocity = nullptr);
+
+    void Reset();
+
+    void AddImu(double time, const Vector3d &acc, const Vector3d &gyr);
+
+private:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    void Propagate(const Measurement &m);
+
+    void Emit(const TimePoint &input_time, std::unique_lock<std::mutex> &lock);
+
+    std::mutex mutex_;
+    std::vector<Callback> callbacks_;
+    std::deque<Measurement, Eigen::aligned_allocator<Measurement>> buf_; // samples after the visual state
+    const size_t capacity_;
+
+    // the last visual state
+    bool has_state_ = false;
+    double state_time_ = 0;
+    SE3d state_pose_;
+    Vector3d ba_ = Vector3d::Zero(), bg_ = Vector3d::Zero();
+
+    // the propagated state
+    double time_ = 0;
+    SE3d pose_;
+    Vector3d velocity_ = Vector3d::Zero();
+    Vector3d acc_ = Vector3d::Zero(), gyr_ = Vector3d::Zero();
+};
+
+} // namespace imu
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_PROPAGATOR_H
@@ -4,7 +4,9 @@
 #include "lvio_fusion/adapt/problem.h"
 #include "lvio_fusion/common.h"
 #include "lvio_fusion/frame.h"
+#include "lvio_fusion/lidar/deskew.h"
 #include "lvio_fusion/lidar/projection.h"
+#include "lvio_fusion/lidar/scan_buffer.h"
 
 #include <ceres/ceres.h>
 
@@ -18,14 +20,14 @@ class FeatureAssociation
 public:
     typedef std::shared_ptr<FeatureAssociation> Ptr;
 
-    FeatureAssociation(int num_scans, int horizon_scan, double ang_res_y, double ang_bottom, int ground_rows, double cycle_time, double min_range, double max_range, double deskew)
-        : num_scans_(num_scans), cycle_time_(cycle_time), min_range_(min_range), max_range_(max_range), deskew_(deskew)
+    FeatureAssociation(int num_scans, int horizon_scan, double ang_res_y, double ang_bottom, int ground_rows, double cycle_time, double min_range, double max_range, double deskew, int ring_order)
+        : num_scans_(num_scans), cycle_time_(cycle_time), min_range_(min_range), max_range_(max_range), deskew_(deskew), deskew_table_(horizon_scan / 10), scan_buffer_(cycle_time, 10)
     {
         curvatures = new float[num_scans * horizon_scan];
-        projection_ = ImageProjection::Ptr(new ImageProjection(num_scans, horizon_scan, ang_res_y, ang_bottom, ground_rows));
+        projection_ = ImageProjection::Ptr(new ImageProjection(num_scans, horizon_scan, ang_res_y, ang_bottom, ground_rows, ring_order));
     }
 
-    void AddScan(double time, Point3Cloud::Ptr new_scan);
+    void AddScan(double time, PointICloud::Ptr new_scan, bool has_time, bool has_ring);
 
     void ScanToMapWithGround(Frame::Ptr frame, Frame::Ptr map_frame, double *para, adapt::Problem &problem);
 
@@ -33,16 +35,11 @@ public:
     void SegmentGround(PointICloud &points_ground);
 
 private:
-    void UndistortPoint(PointI &point, Frame::Ptr frame);
-    void UndistortPointCloud(PointICloud &points, Frame::Ptr frame);
+    void Process(PointICloud &points, Frame::Ptr frame, bool has_time);
 
-    bool AlignScan(double time, PointICloud &out);
+    void Preprocess(const ScanBuffer::View &view, double start_time, double end_time, PointICloud &out);
 
-    void Process(PointICloud &points, Frame::Ptr frame);
-
-    void Preprocess(PointICloud &points);
-
-    void Extract(PointICloud &points_segmented, SegmentedInfo &segemented_info, Frame::Ptr frame);
+    void Extract(PointICloud &points_segmented, SegmentedInfo &segemented_info, Frame::Ptr frame, bool has_time);
 
     void AdjustDistortion(PointICloud &points_segmented, SegmentedInfo &segemented_info);
 
@@ -53,8 +50,8 @@ private:
     void Sensor2Robot(PointICloud &in, PointICloud &out);
 
     ImageProjection::Ptr projection_;
-    std::map<double, Point3Cloud::Ptr> raw_point_clouds_;
-    double head_ = 0; // header of the frames' time which already has a point cloud
+    double head_ = 0;       // header of the frames' time which already has a point cloud
+    bool has_ring_ = false; // whether the driver publishes the ring of points
     float *curvatures;
 
     // params
@@ -63,6 +60,8 @@ private:
     const double min_range_;
     const double max_range_;
     const bool deskew_;
+    DeskewTable deskew_table_;
+    ScanBuffer scan_buffer_;
 };
 
 } // namespace lvio_fusion
@@ -0,0 +1,33 @@
+#ifndef lvio_fusion_DESKEW_H
+#define lvio_fusion_DESKEW_H
+
+#include "lvio_fusion/common.h"
+#include "lvio_fusion/frame.h"
+
+namespace lvio_fusion
+{
+
+/**
+ * transforms of time slots in a sweep, from the lidar at the slot to the lidar at the frame,
+ * the poses are computed once per slot instead of once per point.
+ */
+class DeskewTable
+{
+public:
+    DeskewTable(int num_slots) : num_slots_(num_slots), transforms_(num_slots) {}
+
+    void Build(Frame::Ptr frame, double cycle_time);
+
+    void Apply(PointICloud &points);
+
+private:
+    typedef Matrix<float, 3, 4> Transform;
+
+    const int num_slots_;
+    double cycle_time_ = 0;
+    std::vector<Transform, Eigen::aligned_allocator<Transform>> transforms_;
+};
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_DESKEW_H
@@ -3,6 +3,8 @@
 
 #include "lvio_fusion/common.h"
 #include "lvio_fusion/lidar/association.h"
+#include "lvio_fusion/lidar/tiles.h"
+#include "lvio_fusion/lidar/voxel_map.h"
 
 namespace lvio_fusion
 {
@@ -12,7 +14,7 @@ class Mapping
 public:
     typedef std::shared_ptr<Mapping> Ptr;
 
-    Mapping() {}
+    Mapping(double tile_size, int num_tiles, const std::string &tiles_path);
 
     void SetFeatureAssociation(FeatureAssociation::Ptr association) { association_ = association; }
 
@@ -22,20 +24,31 @@ public:
 
     void MergeScan(const PointICloud &in, SE3d from_pose, PointICloud &out);
 
-    void ToWorld(Frame::Ptr frame);
+    void ToWorld(Frame::Ptr frame, PointICloud &points_surf, PointICloud &points_ground);
+
+    lidar::Feature::Ptr GetFeature(Frame::Ptr frame);
+
+    void AddToGlobalMap(const Frames &kfs);
+
+    void UpdateGlobalMap(const Frames &kfs);
 
     PointRGBCloud GetGlobalMap();
 
-    std::map<double, PointRGBCloud> pointclouds_color;
-    std::map<double, PointICloud> pointclouds_surf;
-    std::map<double, PointICloud> pointclouds_ground;
+    std::map<int, PointRGBCloud> GetGlobalMapChanges();
+
+    void UpdateActiveMap(const Frames &active_kfs);
+
+    bool GetActiveMapChange(PointRGBCloud &points);
 
 private:
     void BuildMapFrame(Frame::Ptr frame, Frame::Ptr map_frame);
 
-    void Color(const PointICloud &points_ground, const PointICloud &points_surf, Frame::Ptr frame, PointRGBCloud &out);
-
     FeatureAssociation::Ptr association_;
+    MapTiles::Ptr tiles_;         // lidar features of finalized keyframes and world pointclouds of keyframes
+    VoxelMap::Ptr voxel_map_;     // downsampled global map of finalized keyframes
+    PointRGBCloud active_points_; // downsampled transient layer of keyframes not finalized yet
+    bool active_changed_ = false; // whether the transient layer is changed since the last publication
+    std::mutex mutex_;
 };
 
 } // namespace lvio_fusion
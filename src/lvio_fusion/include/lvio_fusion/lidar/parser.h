@@ -0,0 +1,47 @@
+#ifndef lvio_fusion_PARSER_H
+#define lvio_fusion_PARSER_H
+
+#include "lvio_fusion/common.h"
+
+namespace lvio_fusion
+{
+
+namespace lidar
+{
+
+// same values as sensor_msgs::PointField
+enum class FieldType : uint8_t
+{
+    None = 0,
+    Int8 = 1,
+    UInt8 = 2,
+    Int16 = 3,
+    UInt16 = 4,
+    Int32 = 5,
+    UInt32 = 6,
+    Float32 = 7,
+    Float64 = 8
+};
+
+struct Field
+{
+    FieldType type = FieldType::None; // None means the field is absent
+    uint32_t offset = 0;              // offset in a point in bytes
+    double scale = 1;                 // e.g. 1e-9 for time in nanoseconds
+};
+
+// layout of points in a raw little-endian buffer, it differs between lidar drivers
+struct FieldLayout
+{
+    Field x, y, z, intensity, ring, time;
+    uint32_t point_step = 0;
+    uint32_t row_step = 0; // rows may be padded
+};
+
+bool ParsePoints(const uint8_t *data, size_t size, uint32_t width, uint32_t height, const FieldLayout &layout, PointICloud &out);
+
+} // namespace lidar
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_PARSER_H
@@ -6,11 +6,12 @@ namespace lvio_fusion
 class SegmentedInfo
 {
 public:
+    // allocated once, only the first points of the segmented cloud are written in each scan
     SegmentedInfo(double num_scans, double horizon_scan)
     {
         start_ring_index.assign(num_scans, 0);
         end_ring_index.assign(num_scans, 0);
-        ground_flag.assign(num_scans * horizon_scan, false);
+        ground_flag.assign(num_scans * horizon_scan, 0);
         col_ind.assign(num_scans * horizon_scan, 0);
         range.assign(num_scans * horizon_scan, 0);
     }
@@ -22,7 +23,7 @@ public:
     float end_orientation;
     float orientation_diff;
 
-    std::vector<bool> ground_flag;     // true - ground point, false - other points
+    std::vector<uint8_t> ground_flag;  // 1 - ground point, 0 - other points
     std::vector<unsigned int> col_ind; // point column index in range image
     std::vector<float> range;         // point range
 };
@@ -32,32 +33,56 @@ class ImageProjection
 public:
     typedef std::shared_ptr<ImageProjection> Ptr;
 
-    ImageProjection(int num_scans, int horizon_scan, double ang_res_y, double ang_bottom, int ground_rows)
+    ImageProjection(int num_scans, int horizon_scan, double ang_res_y, double ang_bottom, int ground_rows, int ring_order)
         : num_scans_(num_scans), horizon_scan_(horizon_scan),
           ang_res_x_(360.0 / float(horizon_scan)), ang_res_y_(ang_res_y), ang_bottom_(ang_bottom),
-          ground_rows_(ground_rows),
-          segment_alpha_x_(ang_res_x_ / 180.0 * M_PI), segment_alpha_y_(ang_res_y_ / 180.0 * M_PI)
+          ground_rows_(ground_rows), ring_order_(ring_order),
+          segment_alpha_x_(ang_res_x_ / 180.0 * M_PI), segment_alpha_y_(ang_res_y_ / 180.0 * M_PI),
+          connect_x_(cos(segment_alpha_x_) + sin(segment_alpha_x_) / tan(theta)),
+          connect_y_(cos(segment_alpha_y_) + sin(segment_alpha_y_) / tan(theta)),
+          segmented_info_(num_scans, horizon_scan)
     {
         points_full.points.resize(num_scans_ * horizon_scan);
+        parents_.resize(num_scans_ * horizon_scan);
+        components_.resize(num_scans_ * horizon_scan);
+        range_mat = cv::Mat(num_scans_, horizon_scan_, CV_32F);
+        ground_mat = cv::Mat(num_scans_, horizon_scan_, CV_8S);
+        label_mat = cv::Mat(num_scans_, horizon_scan_, CV_32S);
         Clear();
     }
 
-    SegmentedInfo Process(PointICloud &points, PointICloud &points_segmented);
+    SegmentedInfo &Process(PointICloud &points, PointICloud &points_segmented, bool has_ring);
 
 private:
     void FindStartEndAngle(SegmentedInfo &segmented_info, PointICloud& points);
 
-    void ProjectPointCloud(SegmentedInfo &segmented_info, PointICloud& points);
+    void ProjectPointCloud(SegmentedInfo &segmented_info, PointICloud& points, bool has_ring);
 
     void RemoveGround(SegmentedInfo &segmented_info);
 
     void Segment(SegmentedInfo &segmented_info, PointICloud &points_segmented);
 
-    void LabelComponents(int row, int col);
+    void LabelComponents();
+
+    int Find(int i);
+
+    void Union(int a, int b);
 
     void Clear();
 
-    PointICloud points_full; // projected velodyne raw cloud, but saved in the form of 1-D matrix
+    PointICloud points_full; // projected velodyne raw cloud, but saved in the form of 1-D matrix, valid where range_mat is set
+    std::vector<int> rows_, cols_; // image indexes of raw points, -1 means out of image
+    std::vector<float> ranges_;    // ranges of raw points
+
+    struct Component
+    {
+        int size = 0;
+        int num_lines = 0;
+        int last_line = -1;
+        int label = 0;
+    };
+    std::vector<int> parents_;           // union-find forest of pixels
+    std::vector<Component> components_;  // indexed by roots
 
     cv::Mat range_mat;  // range matrix for range image
     cv::Mat label_mat;  // label matrix for segmentaiton marking
@@ -71,12 +96,17 @@ private:
     const float ang_res_y_;
     const float ang_bottom_;
     const int ground_rows_;
+    const int ring_order_; // 0 - rows by vertical angles, 1 - rings of the driver count from the bottom beam, -1 - from the top beam
 
     const float theta = 60.0 / 180.0 * M_PI; // decrese this value may improve accuracy
     const int num_segment_valid_points_ = 5;
     const int num_segment_valid_lines_ = 3;
     const float segment_alpha_x_;
     const float segment_alpha_y_;
+    const float connect_x_; // neighbors are in the same segment if the ratio of their ranges is less than it
+    const float connect_y_;
+
+    SegmentedInfo segmented_info_;
 };
 
 } // namespace lvio_fusion
\ No newline at end of file
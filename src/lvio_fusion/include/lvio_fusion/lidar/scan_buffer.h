@@ -0,0 +1,53 @@
+#ifndef lvio_fusion_SCAN_BUFFER_H
+#define lvio_fusion_SCAN_BUFFER_H
+
+#include "lvio_fusion/common.h"
+
+#include <deque>
+
+namespace lvio_fusion
+{
+
+/**
+ * buffer of raw lidar scans, sweeps are extracted as views of the scans without copying.
+ * if the driver publishes the time of points, a point is at the time of its scan plus its time field,
+ * otherwise a scan at time t covers [t - cycle_time / 2, t + cycle_time / 2] and its points are evenly spaced in time.
+ */
+class ScanBuffer
+{
+public:
+    // points [begin, end) of a scan, the time of the i-th point is time + point.time if has_time, otherwise time + i * dt
+    struct Span
+    {
+        PointICloud::Ptr scan;
+        size_t begin, end;
+        double time, dt;
+        bool has_time;
+    };
+    typedef std::vector<Span> View;
+
+    ScanBuffer(double cycle_time, int capacity) : cycle_time_(cycle_time), capacity_(capacity) {}
+
+    void Push(double time, PointICloud::Ptr scan, bool has_time);
+
+    bool Extract(double start_time, double end_time, View &view);
+
+    void Release(double time);
+
+private:
+    struct Scan
+    {
+        double time;
+        double start_time, end_time; // times of the first and the last points
+        PointICloud::Ptr points;
+        bool has_time;
+    };
+
+    const double cycle_time_;
+    const int capacity_;
+    std::deque<Scan> scans_;
+};
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_SCAN_BUFFER_H
@@ -0,0 +1,81 @@
+#ifndef lvio_fusion_TILES_H
+#define lvio_fusion_TILES_H
+
+#include "lvio_fusion/common.h"
+#include "lvio_fusion/lidar/feature.h"
+
+#include <list>
+#include <set>
+
+namespace lvio_fusion
+{
+
+/**
+ * store of lidar features of finalized keyframes, grouped into square tiles by the positions of keyframes,
+ * with a cache of world pointclouds, each is saved with the pose it is transformed by.
+ * tiles out of the neighborhood of the vehicle are evicted in LRU order,
+ * they are spilled to disk if a path is given, else only their world pointclouds are dropped.
+ * NOTE: not thread safe, the owner should lock it.
+ */
+class MapTiles
+{
+public:
+    typedef std::shared_ptr<MapTiles> Ptr;
+    typedef std::pair<int, int> Key;
+
+    MapTiles(double size, int num_tiles, const std::string &path);
+
+    void Insert(double time, const SE3d &pose, const PointICloud &points_surf, const PointICloud &points_ground);
+
+    bool Get(double time, SE3d &pose, PointICloud &points_surf, PointICloud &points_ground);
+
+    void InsertFeature(double time, const SE3d &pose, lidar::Feature::Ptr feature);
+
+    lidar::Feature::Ptr GetFeature(double time);
+
+private:
+    struct Entry
+    {
+        bool cached = false; // whether the world pointclouds are transformed by the pose
+        SE3d pose;
+        PointICloud points_surf;
+        PointICloud points_ground;
+        lidar::Feature::Ptr feature; // lidar features in the body frame, owned by the tiles
+    };
+
+    struct Tile
+    {
+        std::map<double, Entry> entries;
+        std::list<Key>::iterator lru;
+        bool hot = false;   // whether it is in the LRU list, the world pointclouds of cold tiles are dropped
+        bool saved = false; // whether the file on disk is the same as it
+    };
+
+    Key ToKey(const Vector3d &position);
+
+    Tile &Load(const Key &key);
+
+    Entry &Find(double time, const SE3d &pose);
+
+    void Evict();
+
+    std::string FileName(const Key &key);
+
+    bool Read(const Key &key, std::map<double, Entry> &entries);
+
+    void Write(const Key &key, const std::map<double, Entry> &entries);
+
+    const double size_;
+    const int num_tiles_;
+    const std::string path_;
+    std::map<Key, Tile> tiles_;       // tiles in memory
+    std::set<Key> spilled_;           // tiles only on disk
+    std::list<Key> lru_;              // hot tiles, most recently used first
+    std::map<double, Key> locations_; // tiles of keyframes
+    Key center_;
+    double latest_time_ = 0;
+};
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_TILES_H
@@ -0,0 +1,93 @@
+#ifndef lvio_fusion_VOXEL_MAP_H
+#define lvio_fusion_VOXEL_MAP_H
+
+#include "lvio_fusion/common.h"
+
+#include <set>
+
+namespace lvio_fusion
+{
+
+struct VoxelKey
+{
+    int x, y, z;
+
+    bool operator==(const VoxelKey &other) const
+    {
+        return x == other.x && y == other.y && z == other.z;
+    }
+
+    bool operator<(const VoxelKey &other) const
+    {
+        return x != other.x ? x < other.x : (y != other.y ? y < other.y : z < other.z);
+    }
+};
+
+struct VoxelKeyHash
+{
+    size_t operator()(const VoxelKey &key) const
+    {
+        return ((size_t)key.x * 73856093) ^ ((size_t)key.y * 19349663) ^ ((size_t)key.z * 83492791);
+    }
+};
+
+/**
+ * downsampled global map, a voxel is the centroid of points of keyframes in it,
+ * contributions of keyframes are saved so a keyframe can be replaced after its pose is corrected.
+ * voxels are grouped into regions, changed regions are collected for delta publication.
+ * NOTE: not thread safe, the owner should lock it.
+ */
+class VoxelMap
+{
+public:
+    typedef std::shared_ptr<VoxelMap> Ptr;
+
+    VoxelMap(double resolution, int region_size) : resolution_(resolution), region_size_(region_size) {}
+
+    void Insert(double time, const SE3d &pose, const PointICloud &points_surf, const PointICloud &points_ground);
+
+    void Remove(double time);
+
+    bool Contains(double time, SE3d &pose);
+
+    PointRGBCloud GetAll();
+
+    std::map<int, PointRGBCloud> GetChanges();
+
+private:
+    struct Voxel
+    {
+        Vector3d sum = Vector3d::Zero();
+        int num = 0;
+        int num_ground = 0;
+    };
+
+    struct Region
+    {
+        int id;
+        std::unordered_map<VoxelKey, Voxel, VoxelKeyHash> voxels;
+    };
+
+    struct Contribution
+    {
+        SE3d pose;
+        std::unordered_map<VoxelKey, Voxel, VoxelKeyHash> voxels;
+    };
+
+    VoxelKey ToRegion(const VoxelKey &key);
+
+    void Add(const PointICloud &points, bool ground, std::unordered_map<VoxelKey, Voxel, VoxelKeyHash> &voxels);
+
+    void ToCloud(const Region &region, PointRGBCloud &out);
+
+    const double resolution_;
+    const int region_size_;
+    std::map<VoxelKey, Region> regions_;
+    std::map<double, Contribution> contributions_; // key is the time of keyframe
+    std::set<VoxelKey> changed_regions_;
+    int num_regions_ = 0;
+};
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_VOXEL_MAP_H
@@ -10,6 +10,7 @@
 #include "lvio_fusion/lidar/mapping.h"
 #include "lvio_fusion/loop/loop.h"
 #include "lvio_fusion/loop/pose_graph.h"
+#include "lvio_fusion/visual/extractor.h"
 
 #include <DBoW3/DBoW3.h>
 #include <DBoW3/Database.h>
@@ -36,11 +37,9 @@ inline BRIEF mat2brief(const cv::Mat &mat)
 inline std::map<unsigned long, BRIEF> mat2briefs(Frame::Ptr frame)
 {
     std::map<unsigned long, BRIEF> briefs;
-    int i = 0;
-    for (auto pair_feature : frame->features_left)
+    for (auto pair_descriptor : frame->descriptors)
     {
-        briefs[pair_feature.first] = mat2brief(frame->descriptors.row(i));
-        i++;
+        briefs[pair_descriptor.first] = mat2brief(pair_descriptor.second);
     }
     return briefs;
 }
@@ -62,7 +61,9 @@ public:
 
     void SetPoseGraph(PoseGraph::Ptr pose_graph) { pose_graph_ = pose_graph; }
 
-    double head = 0;
+    void SetDescriptorExtractor(DescriptorExtractor::Ptr extractor) { extractor_ = extractor; }
+
+    void AddKeyFrames(const Frames &kfs);
 
 private:
     void DetectorLoop();
@@ -81,22 +82,27 @@ private:
 
     int Hamming(const BRIEF &a, const BRIEF &b);
 
-    void BuildProblem(Frames &active_kfs, adapt::Problem &problem);
-
     void BuildProblemWithLoop(Frames &active_kfs, adapt::Problem &problem);
 
     void CorrectLoop(double old_time, double start_time, double end_time);
 
+    const std::string voc_path_;
     DBoW3::Database db_;
-    DBoW3::Vocabulary voc_;
     Mapping::Ptr mapping_;
     Frontend::Ptr frontend_;
     Backend::Ptr backend_;
     FeatureAssociation::Ptr association_;
     PoseGraph::Ptr pose_graph_;
+    DescriptorExtractor::Ptr extractor_;
 
     std::thread thread_;
-    cv::Ptr<cv::Feature2D> detector_;
+    std::mutex mutex_;
+    std::condition_variable new_kfs_;
+    Frames kfs_queue_;                    // finalized keyframes from the backend
+    const size_t max_queries_ = 100;      // max number of keyframes queried in a batch
+    double old_time_ = DBL_MAX;           // time of the first old frame of current loop
+    double start_time_ = DBL_MAX;         // time of the first frame of current loop
+    Frame::Ptr last_frame_;               // the last frame of current loop
     std::map<DBoW3::EntryId, double> map_dbow_to_frames_;
 };
 
@@ -22,6 +22,19 @@ public:
     SE3d relative_o_c;
 };
 
+// keyframes of [A, end_time] are moved by their deltas, and later frames are moved by transform,
+// deltas are composed with the current poses, so changes made after the snapshot are kept
+class Correction
+{
+public:
+    typedef std::shared_ptr<Correction> Ptr;
+
+    int version = 0;
+    double end_time = 0;
+    std::map<double, SE3d> deltas; // optimized pose * snapshot pose^-1
+    SE3d transform;
+};
+
 } // namespace loop
 } // namespace lvio_fusion
 
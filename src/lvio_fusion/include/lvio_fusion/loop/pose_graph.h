@@ -5,6 +5,7 @@
 #include "lvio_fusion/common.h"
 #include "lvio_fusion/frame.h"
 #include "lvio_fusion/frontend.h"
+#include "lvio_fusion/loop/loop.h"
 
 namespace lvio_fusion
 {
@@ -34,8 +35,16 @@ public:
 
     void BuildProblem(Atlas &sections, adapt::Problem &problem);
 
+    void BuildProblem(Frames &active_kfs, adapt::Problem &problem);
+
     void Optimize(Atlas &sections, adapt::Problem &problem);
 
+    void Optimize(Frames &all_kfs, Frames &active_kfs, adapt::Problem &problem, std::map<double, SE3d> &inner_old_frames);
+
+    void Publish(loop::Correction::Ptr correction);
+
+    Frames ApplyCorrections();
+
     void ForwardPropagate(SE3d transfrom, double start_time);
 
     void ForwardPropagate(SE3d transfrom, const Frames& forward_kfs);
@@ -44,6 +53,9 @@ private:
     void UpdateSections(double time);
 
     Frontend::Ptr frontend_;
+    std::mutex mutex_;
+    std::queue<loop::Correction::Ptr> corrections_;
+    int version_ = 0;
 
     Atlas atlas_;    // loop altas
     Atlas sections_; // sections
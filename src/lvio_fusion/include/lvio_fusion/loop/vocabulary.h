@@ -0,0 +1,22 @@
+#ifndef lvio_fusion_VOCABULARY_H
+#define lvio_fusion_VOCABULARY_H
+
+#include "lvio_fusion/common.h"
+
+#include <DBoW3/Vocabulary.h>
+
+namespace lvio_fusion
+{
+
+namespace loop
+{
+
+void LoadVocabulary(const std::string &path, DBoW3::Vocabulary &voc);
+
+void ConvertVocabulary(const std::string &input, const std::string &output);
+
+} // namespace loop
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_VOCABULARY_H
@@ -0,0 +1,113 @@
+#ifndef lvio_fusion_MAP_FILE_H
+#define lvio_fusion_MAP_FILE_H
+
+#include "lvio_fusion/common.h"
+#include "lvio_fusion/frame.h"
+#include "lvio_fusion/visual/extractor.h"
+
+#include <fstream>
+
+namespace lvio_fusion
+{
+
+/**
+ * binary map file, a header followed by appended chunks:
+ * header: magic[8], version(u32), reserved(u32)
+ * chunk:  type(u32), size(u32), time(f64), payload[size]
+ * the last pose of a keyframe in the file wins, so corrections are appended instead of rewritten
+ */
+namespace map_file
+{
+
+const char magic[8] = {'L', 'V', 'I', 'O', 'M', 'A', 'P', '\0'};
+const uint32_t version = 1;
+
+enum ChunkType : uint32_t
+{
+    KeyFrame = 1,    // id(u64), pose(7 x f64)
+    Features = 2,    // n(u32), [landmark id(u64), x(f32), y(f32)] x n
+    Landmarks = 3,   // n(u32), [landmark id(u64), position(3 x f64), right x(f32), right y(f32)] x n
+    Descriptors = 4, // n(u32), [landmark id(u64), descriptor(32 x u8)] x n
+    Lidar = 5,       // n_surf(u32), n_ground(u32), [x, y, z, intensity(4 x f32)] x (n_surf + n_ground)
+    Poses = 6,       // n(u32), [time(f64), pose(7 x f64)] x n
+};
+
+struct ChunkHeader
+{
+    uint32_t type;
+    uint32_t size;
+    double time;
+};
+
+} // namespace map_file
+
+// append finalized keyframes to the map file in the background
+class MapWriter
+{
+public:
+    typedef std::shared_ptr<MapWriter> Ptr;
+
+    MapWriter(const std::string &path, size_t offset = 0);
+
+    void SetDescriptorExtractor(DescriptorExtractor::Ptr extractor) { extractor_ = extractor; }
+
+    void AddKeyFrames(const Frames &kfs);
+
+    void UpdatePoses(const Frames &kfs);
+
+private:
+    void WriterLoop();
+
+    void WriteDescriptors(Frame::Ptr frame);
+
+    void WriteChunk(uint32_t type, double time, const std::vector<char> &payload);
+
+    std::ofstream file_;
+    DescriptorExtractor::Ptr extractor_;
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable new_data_;
+    // keyframes and their chunks serialized by the owner of the keyframes, descriptors are written later
+    std::vector<std::pair<Frame::Ptr, std::vector<char>>> kfs_queue_;
+    std::map<double, SE3d> poses_queue_;
+};
+
+// read a map file by memory mapping, sections are decoded only when requested
+class MapReader
+{
+public:
+    typedef std::shared_ptr<MapReader> Ptr;
+
+    static MapReader::Ptr Open(const std::string &path);
+
+    ~MapReader();
+
+    std::map<double, SE3d> GetPoses();
+
+    Frames LoadKeyFrames(double start = 0, double end = 0);
+
+    // size of the complete chunks, a truncated chunk at the end is not counted
+    size_t Size() const { return valid_size_; }
+
+    // time of the last keyframe in the file, 0 if it is empty
+    double EndTime() const { return index_.empty() ? 0 : index_.rbegin()->first; }
+
+private:
+    MapReader() {}
+
+    const char *Payload(double time, map_file::ChunkType type, uint32_t &size);
+
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    size_t valid_size_ = 0;
+    // offsets of chunks, key is the time of the keyframe
+    std::map<double, std::map<uint32_t, size_t>> index_;
+    std::vector<size_t> poses_chunks_;
+    // landmarks loaded before, key is the id in the file
+    visual::Landmarks landmarks_;
+};
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_MAP_FILE_H
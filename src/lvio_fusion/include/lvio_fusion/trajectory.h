@@ -0,0 +1,33 @@
+#ifndef lvio_fusion_TRAJECTORY_H
+#define lvio_fusion_TRAJECTORY_H
+
+#include "lvio_fusion/common.h"
+#include "lvio_fusion/frame.h"
+
+namespace lvio_fusion
+{
+
+// output of keyframe poses, only the changed or recent ones are handed out
+class Trajectory
+{
+public:
+    typedef std::shared_ptr<Trajectory> Ptr;
+
+    Trajectory(double window) : window_(window) {}
+
+    void MarkChanged(const Frames &kfs);
+
+    Frames GetChanges();
+
+    Frames GetRecent();
+
+private:
+    std::mutex mutex_;
+    Frames changed_kfs_; // keyframes whose poses are changed since the last GetChanges
+    double latest_time_ = 0;
+    const double window_; // duration of the recent path in seconds
+};
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_TRAJECTORY_H
@@ -256,6 +256,24 @@ inline T normalize_angle(const T &angle_degrees)
                two_pi * std::floor((-angle_degrees + T(180)) / two_pi);
 };
 
+/**
+ * polynomial approximation of atan2, max error is about 2e-6 rad,
+ * it has no branches so loops calling it can be vectorized
+ * @param y    y
+ * @param x    x
+ * @return angle in radians, in [-pi, pi]
+ */
+inline float fast_atan2(float y, float x)
+{
+    float ax = std::abs(x), ay = std::abs(y);
+    float a = std::min(ax, ay) / (std::max(ax, ay) + std::numeric_limits<float>::min());
+    float s = a * a;
+    float r = (((((-0.0117212f * s + 0.05265332f) * s - 0.11643287f) * s + 0.19354346f) * s - 0.33262347f) * s + 0.99997726f) * a;
+    r = ay > ax ? float(M_PI_2) - r : r;
+    r = x < 0 ? float(M_PI) - r : r;
+    return y < 0 ? -r : r;
+}
+
 inline double vectors_degree_angle(Vector3d v1, Vector3d v2)
 {
     double radian_angle = atan2(v1.cross(v2).norm(), v1.transpose() * v2);
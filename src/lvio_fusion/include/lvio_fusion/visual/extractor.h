@@ -0,0 +1,37 @@
+#ifndef lvio_fusion_EXTRACTOR_H
+#define lvio_fusion_EXTRACTOR_H
+
+#include "lvio_fusion/common.h"
+#include "lvio_fusion/frame.h"
+
+#include <set>
+
+namespace lvio_fusion
+{
+
+// compute orb descriptors of keyframes in worker threads
+class DescriptorExtractor
+{
+public:
+    typedef std::shared_ptr<DescriptorExtractor> Ptr;
+
+    DescriptorExtractor(int num_threads);
+
+    void Add(Frame::Ptr frame);
+
+    void Wait(Frame::Ptr frame);
+
+private:
+    void ExtractorLoop();
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable new_frame_;
+    std::condition_variable finished_;
+    std::queue<std::pair<Frame::Ptr, std::vector<cv::KeyPoint>>> frames_;
+    std::set<unsigned long> pending_ids_;
+};
+
+} // namespace lvio_fusion
+
+#endif // lvio_fusion_EXTRACTOR_H
@@ -19,88 +19,90 @@
 namespace lvio_fusion
 {
 
-void FeatureAssociation::AddScan(double time, Point3Cloud::Ptr new_scan)
+/**
+ * @param time          time of the scan
+ * @param new_scan      raw points
+ * @param has_time      whether the driver publishes the time of points
+ * @param has_ring      whether the driver publishes the ring of points
+ */
+void FeatureAssociation::AddScan(double time, PointICloud::Ptr new_scan, bool has_time, bool has_ring)
 {
     static double head = 0;
-    raw_point_clouds_[time] = new_scan;
+    scan_buffer_.Push(time, new_scan, has_time);
+    has_ring_ = has_ring;
 
     Frames new_kfs = Map::Instance().GetKeyFrames(head, time);
     for (auto pair_kf : new_kfs)
     {
-        PointICloud point_cloud;
-        if (AlignScan(pair_kf.first, point_cloud))
+        ScanBuffer::View view;
+        double start_time = pair_kf.first - cycle_time_ / 2, end_time = pair_kf.first + cycle_time_ / 2;
+        if (scan_buffer_.Extract(start_time, end_time, view))
         {
-            Process(point_cloud, pair_kf.second);
+            PointICloud points;
+            Preprocess(view, start_time, end_time, points);
+            bool has_time = std::all_of(view.begin(), view.end(), [](const ScanBuffer::Span &span) { return span.has_time; });
+            Process(points, pair_kf.second, has_time);
             head = pair_kf.first + epsilon;
+            // the following keyframes are later, so the scans before this sweep are useless
+            scan_buffer_.Release(start_time);
         }
     }
 }
 
-bool FeatureAssociation::AlignScan(double time, PointICloud &out)
+void FeatureAssociation::Process(PointICloud &points, Frame::Ptr frame, bool has_time)
 {
-    auto iter = raw_point_clouds_.upper_bound(time);
-    if (iter == raw_point_clouds_.begin())
-        return false;
-    Point3Cloud &pc2 = *(iter->second);
-    double end_time = iter->first + cycle_time_ / 2;
-    Point3Cloud &pc1 = *((--iter)->second);
-    double start_time = iter->first - cycle_time_ / 2;
-    Point3Cloud pc = pc1 + pc2;
-    int size = pc.size();
-    if (time - cycle_time_ / 2 < start_time || time + cycle_time_ / 2 > end_time)
-    {
-        return false;
-    }
-    auto start_iter = pc.begin() + size * (time - start_time - cycle_time_ / 2) / (end_time - start_time);
-    auto end_iter = pc.begin() + size * (time - start_time + cycle_time_ / 2) / (end_time - start_time);
-    Point3Cloud out3;
-    out3.clear();
-    out3.insert(out3.begin(), start_iter, end_iter);
-    pcl::copyPointCloud(out3, out);
-    raw_point_clouds_.erase(raw_point_clouds_.begin(), iter);
-    return true;
-}
+    PointICloud points_segmented;
+    auto &segmented_info = projection_->Process(points, points_segmented, has_ring_);
 
-void FeatureAssociation::UndistortPoint(PointI &point, Frame::Ptr frame)
-{
-    double time_delta = (point.intensity - int(point.intensity));
-    double time = frame->time - cycle_time_ * 0.5 + time_delta;
-    SE3d pose = Map::Instance().ComputePose(time);
-    auto p1 = Lidar::Get()->Sensor2World(Vector3d(point.x, point.y, point.z), pose);
-    auto p2 = Lidar::Get()->World2Sensor(p1, frame->pose);
-    point.x = p2.x();
-    point.y = p2.y();
-    point.z = p2.z();
+    Extract(points_segmented, segmented_info, frame, has_time);
 }
 
-inline void FeatureAssociation::UndistortPointCloud(PointICloud &points, Frame::Ptr frame)
+/**
+ * copy the points of the sweep which are valid and in range, it is the only copy of raw points
+ * @param view          spans of the sweep
+ * @param start_time    start of the sweep
+ * @param end_time      end of the sweep
+ * @param out           output, the time of points is the offset from the start of the sweep
+ */
+void FeatureAssociation::Preprocess(const ScanBuffer::View &view, double start_time, double end_time, PointICloud &out)
 {
-    for (auto &p : points)
+    float min_range2 = min_range_ * min_range_, max_range2 = max_range_ * max_range_;
+    size_t size = 0;
+    for (auto &span : view)
     {
-        UndistortPoint(p, frame);
+        size += span.end - span.begin;
+    }
+    out.clear();
+    out.reserve(size);
+    for (auto &span : view)
+    {
+        auto &points = span.scan->points;
+        for (size_t i = span.begin; i < span.end; i++)
+        {
+            const PointI &point = points[i];
+            double time = span.has_time ? span.time + point.time : span.time + i * span.dt;
+            float d = point.x * point.x + point.y * point.y + point.z * point.z;
+            if (time < start_time || time >= end_time || !std::isfinite(d) || d <= min_range2 || d >= max_range2)
+                continue;
+            out.push_back(point);
+            out.back().time = time - start_time;
+        }
     }
 }
 
-void FeatureAssociation::Process(PointICloud &points, Frame::Ptr frame)
-{
-    Preprocess(points);
-
-    PointICloud points_segmented;
-    auto segmented_info = projection_->Process(points, points_segmented);
-
-    Extract(points_segmented, segmented_info, frame);
-}
-
-void FeatureAssociation::Preprocess(PointICloud &points)
+void FeatureAssociation::Extract(PointICloud &points_segmented, SegmentedInfo &segemented_info, Frame::Ptr frame, bool has_time)
 {
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(points, points, indices);
-    filter_points_by_distance(points, points, min_range_, max_range_);
-}
+    // the time of the driver is exact, it is only estimated by the orientation if it is absent
+    if (!has_time)
+    {
+        AdjustDistortion(points_segmented, segemented_info);
+    }
 
-void FeatureAssociation::Extract(PointICloud &points_segmented, SegmentedInfo &segemented_info, Frame::Ptr frame)
-{
-    AdjustDistortion(points_segmented, segemented_info);
+    if (deskew_)
+    {
+        deskew_table_.Build(frame, cycle_time_);
+        deskew_table_.Apply(points_segmented);
+    }
 
     CalculateSmoothness(points_segmented, segemented_info);
 
@@ -111,13 +113,9 @@ void FeatureAssociation::AdjustDistortion(PointICloud &points_segmented, Segment
 {
     bool half_passed = false;
     int size = points_segmented.size();
-    PointI point;
     for (int i = 0; i < size; i++)
     {
-        point.x = points_segmented[i].x;
-        point.y = points_segmented[i].y;
-        point.z = points_segmented[i].z;
-
+        PointI &point = points_segmented[i];
         float ori = -atan2(point.y, point.x);
         if (!half_passed)
         {
@@ -139,9 +137,7 @@ void FeatureAssociation::AdjustDistortion(PointICloud &points_segmented, Segment
         }
 
         float rel_time = (ori - segemented_info.start_orientation) / segemented_info.orientation_diff;
-        point.intensity = int(points_segmented[i].intensity) + cycle_time_ * rel_time;
-        //TODO:deskew
-        points_segmented[i] = point;
+        point.time = cycle_time_ * rel_time;
     }
 }
 
@@ -225,9 +221,8 @@ inline void FeatureAssociation::Sensor2Robot(PointICloud &in, PointICloud &out)
     float *tf = tf_se3.data();
     for (auto point_in : in)
     {
-        PointI point_out;
+        PointI point_out = point_in;
         ceres::SE3TransformPoint(tf, point_in.data, point_out.data);
-        point_out.intensity = point_in.intensity;
         out.push_back(point_out);
     }
 }
@@ -3,6 +3,7 @@
 #include "lvio_fusion/ceres/navsat_error.hpp"
 #include "lvio_fusion/ceres/visual_error.hpp"
 #include "lvio_fusion/frontend.h"
+#include "lvio_fusion/loop/detector.h"
 #include "lvio_fusion/manager.h"
 #include "lvio_fusion/map.h"
 #include "lvio_fusion/utility.h"
@@ -95,36 +96,54 @@ void Backend::BuildProblem(Frames &active_kfs, adapt::Problem &problem)
         }
     }
 
-    // TODO
-    // imu constraints
-    // if (imu_ && imu_->initialized)
-    // {
-    //     Frame::Ptr last_frame;
-    //     Frame::Ptr current_frame;
-    //     for (auto pair_kf : active_kfs)
-    //     {
-    //         current_frame = pair_kf.second;
-    //         if (!current_frame->preintegration)
-    //             continue;
-    //         auto para_kf = current_frame->pose.data();
-    //         auto para_v = current_frame->preintegration->v0.data();
-    //         auto para_ba = current_frame->preintegration->linearized_ba.data();
-    //         auto para_bg = current_frame->preintegration->linearized_bg.data();
-    //         problem.AddParameterBlock(para_v, 3);
-    //         problem.AddParameterBlock(para_ba, 3);
-    //         problem.AddParameterBlock(para_bg, 3);
-    //         if (last_frame && last_frame->preintegration)
-    //         {
-    //             auto para_kf_last = last_frame->pose.data();
-    //             auto para_v_last = last_frame->preintegration->v0.data();
-    //             auto para_ba_last = last_frame->preintegration->linearized_ba.data();
-    //             auto para_bg_last = last_frame->preintegration->linearized_bg.data();
-    //             ceres::CostFunction *cost_function = ImuError::Create(last_frame->preintegration);
-    //             problem.AddResidualBlock(cost_function, NULL, para_kf_last, para_v_last, para_ba_last, para_bg_last, para_kf, para_v, para_ba, para_bg);
-    //         }
-    //         last_frame = current_frame;
-    //     }
-    // }
+    // imu constraints, speeds and biases are stored in the preintegration of each keyframe
+    if (Imu::Num() && Imu::Get()->initialized)
+    {
+        Frame::Ptr last_frame;
+        for (auto pair_kf : active_kfs)
+        {
+            auto frame = pair_kf.second;
+            if (!frame->preintegration)
+            {
+                last_frame = nullptr;
+                continue;
+            }
+            auto para_kf = frame->pose.data();
+            auto para_v = frame->preintegration->v0.data();
+            auto para_ba = frame->preintegration->ba.data();
+            auto para_bg = frame->preintegration->bg.data();
+            problem.AddParameterBlock(para_v, 3);
+            problem.AddParameterBlock(para_ba, 3);
+            problem.AddParameterBlock(para_bg, 3);
+            // the preintegration of the last frame must end at this frame
+            if (last_frame && fabs(last_frame->time + last_frame->preintegration->sum_dt - frame->time) < 1e-3)
+            {
+                auto para_kf_last = last_frame->pose.data();
+                auto para_v_last = last_frame->preintegration->v0.data();
+                auto para_ba_last = last_frame->preintegration->ba.data();
+                auto para_bg_last = last_frame->preintegration->bg.data();
+                ceres::CostFunction *cost_function = ImuError::Create(last_frame->preintegration);
+                problem.AddResidualBlock(ProblemType::IMUError, cost_function, NULL, para_kf_last, para_v_last, para_ba_last, para_bg_last, para_kf, para_v, para_ba, para_bg);
+            }
+            last_frame = frame;
+        }
+    }
+}
+
+// relinearize finished preintegrations at the optimized biases
+void update_preintegrations(Frames &active_kfs)
+{
+    if (!Imu::Num() || !Imu::Get()->initialized || active_kfs.empty())
+        return;
+
+    for (auto iter = active_kfs.begin(); iter != --active_kfs.end(); iter++)
+    {
+        auto preintegration = iter->second->preintegration;
+        if (preintegration)
+        {
+            preintegration->Correct(preintegration->ba, preintegration->bg);
+        }
+    }
 }
 
 double compute_reprojection_error(Vector2d ob, Vector3d pw, SE3d pose, Camera::Ptr camera)
@@ -135,23 +154,48 @@ double compute_reprojection_error(Vector2d ob, Vector3d pw, SE3d pose, Camera::P
     return error.norm();
 }
 
+// apply published loop corrections at once, without waiting for a new keyframe
+void Backend::ApplyCorrections()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    Frames corrected_kfs = pose_graph_->ApplyCorrections();
+    if (mapping_)
+    {
+        mapping_->UpdateGlobalMap(corrected_kfs);
+    }
+    if (map_writer_)
+    {
+        map_writer_->UpdatePoses(corrected_kfs);
+    }
+    if (trajectory_)
+    {
+        trajectory_->MarkChanged(corrected_kfs);
+    }
+}
+
 void Backend::Optimize()
 {
     static double forward_head = 0;
     std::unique_lock<std::mutex> lock(mutex);
     Frames active_kfs = Map::Instance().GetKeyFrames(head);
+    if (active_kfs.empty())
+        return;
 
-    // TODO: IMU
     // imu init
-    // if (imu_ && !initializer_->initialized)
-    // {
-    //     Frames frames_init = Map::Instance().GetKeyFrames(0, Map::Instance().local_map_head, initializer_->num_frames);
-    //     if (frames_init.size() == initializer_->num_frames)
-    //     {
-    //         imu_->initialized = initializer_->Initialize(frames_init);
-    //         frontend_.lock()->status = FrontendStatus::TRACKING_GOOD;
-    //     }
-    // }
+    if (initializer_ && !initializer_->initialized && !active_kfs.empty())
+    {
+        Frames frames_init = Map::Instance().GetKeyFrames(0, active_kfs.rbegin()->first + epsilon, initializer_->num_frames);
+        if (frames_init.size() == initializer_->num_frames)
+        {
+            auto frontend = frontend_.lock();
+            std::unique_lock<std::mutex> lock(frontend->mutex);
+            Imu::Get()->initialized = initializer_->Initialize(frames_init);
+            if (Imu::Get()->initialized)
+            {
+                frontend->status = FrontendStatus::TRACKING_GOOD;
+            }
+        }
+    }
 
     adapt::Problem problem;
     BuildProblem(active_kfs, problem);
@@ -162,6 +206,7 @@ void Backend::Optimize()
     options.num_threads = 4;
     ceres::Solver::Summary summary;
     ceres::Solve(options, &problem, &summary);
+    update_preintegrations(active_kfs);
 
     if (mapping_)
     {
@@ -171,12 +216,20 @@ void Backend::Optimize()
     if (Navsat::Num() && Navsat::Get()->initialized)
     {
         double start_time = Navsat::Get()->Optimize((--active_kfs.end())->first);
-        if (start_time && mapping_)
+        if (start_time)
         {
-            Frames mapping_kfs = Map::Instance().GetKeyFrames(start_time);
-            for (auto pair : mapping_kfs)
+            Frames navsat_kfs = Map::Instance().GetKeyFrames(start_time);
+            if (mapping_)
             {
-                mapping_->ToWorld(pair.second);
+                mapping_->UpdateGlobalMap(navsat_kfs);
+            }
+            if (map_writer_)
+            {
+                map_writer_->UpdatePoses(navsat_kfs);
+            }
+            if (trajectory_)
+            {
+                trajectory_->MarkChanged(navsat_kfs);
             }
         }
     }
@@ -206,7 +259,28 @@ void Backend::Optimize()
     // propagate to the last frame
     forward_head = (--active_kfs.end())->first + epsilon;
     ForwardPropagate(forward_head);
-    head = forward_head - delay_;
+    if (trajectory_)
+    {
+        trajectory_->MarkChanged(active_kfs);
+    }
+
+    // keyframes before the new head are finalized
+    double new_head = forward_head - delay_;
+    Frames finalized_kfs = Map::Instance().GetKeyFrames(head, new_head - epsilon);
+    if (auto detector = detector_.lock())
+    {
+        detector->AddKeyFrames(finalized_kfs);
+    }
+    if (map_writer_)
+    {
+        map_writer_->AddKeyFrames(finalized_kfs);
+    }
+    if (mapping_)
+    {
+        mapping_->AddToGlobalMap(finalized_kfs);
+        mapping_->UpdateActiveMap(Map::Instance().GetKeyFrames(new_head));
+    }
+    head = new_head;
 }
 
 void Backend::ForwardPropagate(double time)
@@ -229,6 +303,7 @@ void Backend::ForwardPropagate(double time)
     options.num_threads = 4;
     ceres::Solver::Summary summary;
     ceres::Solve(options, &problem, &summary);
+    update_preintegrations(active_kfs);
 
     frontend_.lock()->UpdateCache();
 }
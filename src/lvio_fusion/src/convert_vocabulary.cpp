@@ -0,0 +1,21 @@
+#include "lvio_fusion/loop/vocabulary.h"
+
+#include <iostream>
+
+// convert a DBoW3 vocabulary to the uncompressed binary format
+// usage: convert_vocabulary [input vocabulary] [output vocabulary]
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: convert_vocabulary [input vocabulary] [output vocabulary]" << std::endl;
+        return 1;
+    }
+
+    auto t1 = std::chrono::steady_clock::now();
+    lvio_fusion::loop::ConvertVocabulary(argv[1], argv[2]);
+    auto t2 = std::chrono::steady_clock::now();
+    auto time_used = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1);
+    std::cout << "Convert vocabulary cost time: " << time_used.count() << " seconds." << std::endl;
+    return 0;
+}
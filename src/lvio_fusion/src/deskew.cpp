@@ -0,0 +1,42 @@
+#include "lvio_fusion/lidar/deskew.h"
+#include "lvio_fusion/lidar/lidar.h"
+#include "lvio_fusion/map.h"
+
+namespace lvio_fusion
+{
+
+/**
+ * compute the transforms of the sweep around the frame with the poses of keyframes
+ * @param frame         the sweep is [time - cycle_time / 2, time + cycle_time / 2]
+ * @param cycle_time
+ */
+void DeskewTable::Build(Frame::Ptr frame, double cycle_time)
+{
+    cycle_time_ = cycle_time;
+    SE3d extrinsic = Lidar::Get()->extrinsic;
+    SE3d T_frame_inv = (frame->pose * extrinsic).inverse();
+    for (int i = 0; i < num_slots_; i++)
+    {
+        // the middle of the slot
+        double time = frame->time - cycle_time * 0.5 + cycle_time * (i + 0.5) / num_slots_;
+        SE3d T = T_frame_inv * Map::Instance().ComputePose(time) * extrinsic;
+        transforms_[i] = T.matrix3x4().cast<float>();
+    }
+}
+
+/**
+ * deskew points in the lidar coordinate
+ * @param points    time of points is the offset in the sweep
+ */
+void DeskewTable::Apply(PointICloud &points)
+{
+    for (auto &point : points)
+    {
+        int slot = std::min(std::max(int(point.time / cycle_time_ * num_slots_), 0), num_slots_ - 1);
+        const Transform &T = transforms_[slot];
+        Eigen::Map<Vector3f> p(point.data);
+        p = T.leftCols<3>() * p + T.col(3);
+    }
+}
+
+} // namespace lvio_fusion
@@ -1,4 +1,5 @@
 #include "lvio_fusion/loop/detector.h"
+#include "lvio_fusion/loop/vocabulary.h"
 #include "lvio_fusion/ceres/lidar_error.hpp"
 #include "lvio_fusion/ceres/loop_error.hpp"
 #include "lvio_fusion/map.h"
@@ -16,84 +17,90 @@
 namespace lvio_fusion
 {
 
-LoopDetector::LoopDetector(std::string voc_path)
+LoopDetector::LoopDetector(std::string voc_path) : voc_path_(voc_path)
 {
-    detector_ = cv::ORB::create();
-    voc_ = DBoW3::Vocabulary(voc_path);
-    db_ = DBoW3::Database(voc_, false, 0);
     thread_ = std::thread(std::bind(&LoopDetector::DetectorLoop, this));
 }
 
+void LoopDetector::AddKeyFrames(const Frames &kfs)
+{
+    if (kfs.empty())
+        return;
+    std::unique_lock<std::mutex> lock(mutex_);
+    kfs_queue_.insert(kfs.begin(), kfs.end());
+    new_kfs_.notify_one();
+}
+
 void LoopDetector::DetectorLoop()
 {
-    static double old_time = DBL_MAX;
-    static double start_time = 0;
-    static Frame::Ptr last_frame;
-    static Frame::Ptr last_old_frame;
+    // load the vocabulary in the loop thread, keyframes are queued meanwhile
+    {
+        auto t1 = std::chrono::steady_clock::now();
+        DBoW3::Vocabulary voc;
+        loop::LoadVocabulary(voc_path_, voc);
+        db_.setVocabulary(voc, false, 0);
+        auto t2 = std::chrono::steady_clock::now();
+        auto time_used = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1);
+        LOG(INFO) << "Load vocabulary cost time: " << time_used.count() << " seconds.";
+    }
+
     while (true)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        auto new_kfs = Map::Instance().GetKeyFrames(head, backend_->head);
-        if (new_kfs.empty())
+        Frames new_kfs;
         {
-            continue;
+            std::unique_lock<std::mutex> lock(mutex_);
+            new_kfs_.wait(lock, [this] { return !kfs_queue_.empty(); });
+            new_kfs.swap(kfs_queue_);
         }
+        // every keyframe is added into the database, but only the latest ones are queried if the thread falls behind
+        size_t num_skipped = new_kfs.size() > max_queries_ ? new_kfs.size() - max_queries_ : 0;
         for (auto pair_kf : new_kfs)
         {
             Frame::Ptr frame = pair_kf.second, old_frame;
             AddKeyFrameIntoVoc(frame);
+            if (num_skipped > 0)
+            {
+                num_skipped--;
+                continue;
+            }
             // if last is loop and this is not loop, then correct all new loops
             if (DetectLoop(frame, old_frame))
             {
-                if (!last_old_frame)
+                if (!last_frame_)
                 {
-                    start_time = pair_kf.first;
+                    start_time_ = pair_kf.first;
                 }
-                old_time = std::min(old_time, old_frame->time);
-                last_frame = frame;
-                last_old_frame = old_frame;
+                old_time_ = std::min(old_time_, old_frame->time);
+                last_frame_ = frame;
             }
-            else if (start_time != DBL_MAX)
+            else if (last_frame_)
             {
-                LOG(INFO) << "Detected new loop, and correct it now. old_time:" << old_time << ";start_time:" << start_time << ";end_time:" << last_frame->time;
+                LOG(INFO) << "Detected new loop, and correct it now. old_time:" << old_time_ << ";start_time:" << start_time_ << ";end_time:" << last_frame_->time;
                 auto t1 = std::chrono::steady_clock::now();
-                CorrectLoop(old_time, start_time, last_frame->time);
+                CorrectLoop(old_time_, start_time_, last_frame_->time);
                 auto t2 = std::chrono::steady_clock::now();
                 auto time_used = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1);
                 LOG(INFO) << "Correct Loop cost time: " << time_used.count() << " seconds.";
-                start_time = old_time = DBL_MAX;
-                last_old_frame = last_frame = nullptr;
+                start_time_ = old_time_ = DBL_MAX;
+                last_frame_ = nullptr;
             }
         }
-        head = (--new_kfs.end())->first + epsilon;
     }
 }
 
 void LoopDetector::AddKeyFrameIntoVoc(Frame::Ptr frame)
 {
-    // compute descriptors
-    std::vector<cv::KeyPoint> keypoints;
-    for (auto pair_feature : frame->features_left)
+    // descriptors are computed by the extractor after the keyframe is created
+    extractor_->Wait(frame);
+    if (frame->descriptors.empty())
+        return;
+    cv::Mat descriptors;
+    for (auto pair_descriptor : frame->descriptors)
     {
-        keypoints.push_back(cv::KeyPoint(pair_feature.second->keypoint, 1));
+        descriptors.push_back(pair_descriptor.second);
     }
-    cv::Mat descriptors;
-    detector_->compute(frame->image_left, keypoints, descriptors);
     DBoW3::EntryId id = db_.add(descriptors);
     map_dbow_to_frames_[id] = frame->time;
-
-    // NOTE: detector_->compute maybe remove some row because its descriptor cannot be computed
-    int j = 0, i = 0;
-    frame->descriptors = cv::Mat::zeros(frame->features_left.size(), 32, CV_8U);
-    for (auto pair_feature : frame->features_left)
-    {
-        if (pair_feature.second->keypoint == keypoints[j].pt && j < descriptors.rows)
-        {
-            descriptors.row(j).copyTo(frame->descriptors.row(i));
-            j++;
-        }
-        i++;
-    }
 }
 
 bool LoopDetector::DetectLoop(Frame::Ptr frame, Frame::Ptr &old_frame)
@@ -228,7 +235,9 @@ bool LoopDetector::RelocateByImage(Frame::Ptr frame, Frame::Ptr old_frame)
 
 bool LoopDetector::RelocateByPoints(Frame::Ptr frame, Frame::Ptr old_frame)
 {
-    if (!frame->feature_lidar || !old_frame->feature_lidar)
+    // lidar features of finalized keyframes are kept in the map tiles
+    lidar::Feature::Ptr feature = mapping_->GetFeature(frame);
+    if (!feature || !mapping_->GetFeature(old_frame))
     {
         return false;
     }
@@ -236,6 +245,7 @@ bool LoopDetector::RelocateByPoints(Frame::Ptr frame, Frame::Ptr old_frame)
     // init relative pose
     Frame::Ptr clone_frame = Frame::Ptr(new Frame());
     *clone_frame = *frame;
+    clone_frame->feature_lidar = feature;
     if (clone_frame->loop_closure->score > 0)
     {
         clone_frame->pose = clone_frame->loop_closure->relative_o_c * old_frame->pose;
@@ -340,29 +350,6 @@ int LoopDetector::Hamming(const BRIEF &a, const BRIEF &b)
     return dis;
 }
 
-void LoopDetector::BuildProblem(Frames &active_kfs, adapt::Problem &problem)
-{
-    ceres::LocalParameterization *local_parameterization = new ceres::ProductParameterization(
-        new ceres::EigenQuaternionParameterization(),
-        new ceres::IdentityParameterization(3));
-
-    Frame::Ptr last_frame;
-    for (auto pair_kf : active_kfs)
-    {
-        auto frame = pair_kf.second;
-        double *para_kf = frame->pose.data();
-        problem.AddParameterBlock(para_kf, SE3d::num_parameters, local_parameterization);
-        if (last_frame)
-        {
-            double *para_last_kf = last_frame->pose.data();
-            ceres::CostFunction *cost_function;
-            cost_function = PoseGraphError::Create(last_frame->pose, frame->pose, frame->weights.pose_graph);
-            problem.AddResidualBlock(ProblemType::Other, cost_function, NULL, para_last_kf, para_kf);
-        }
-        last_frame = frame;
-    }
-}
-
 void LoopDetector::BuildProblemWithLoop(Frames &active_kfs, adapt::Problem &problem)
 {
     ceres::LocalParameterization *local_parameterization = new ceres::ProductParameterization(
@@ -381,7 +368,7 @@ void LoopDetector::BuildProblemWithLoop(Frames &active_kfs, adapt::Problem &prob
             problem.SetParameterBlockConstant(para_kf);
 
             auto old_frame = frame->loop_closure->frame_old;
-            if (old_frame->time >= start_time)
+            if (old_frame->time >= start_time && problem.HasParameterBlock(old_frame->pose.data()))
             {
                 double *para_old_kf = old_frame->pose.data();
                 problem.SetParameterBlockConstant(para_old_kf);
@@ -390,109 +377,121 @@ void LoopDetector::BuildProblemWithLoop(Frames &active_kfs, adapt::Problem &prob
     }
 }
 
-void LoopDetector::CorrectLoop(double old_time, double start_time, double end_time)
+// copy poses and features of frames, so that the pose graph can be optimized without locking the backend
+inline Frames snapshot(const Frames &frames)
 {
-    // build the pose graph and submaps
-    Frames active_kfs = Map::Instance().GetKeyFrames(old_time, end_time);
-    Frames new_submap_kfs = Map::Instance().GetKeyFrames(start_time, end_time);
-    Frames all_kfs = active_kfs;
-    // std::map<double, SE3d> inner_submap_old_frames = atlas_.GetActiveSubMaps(active_kfs, old_time, start_time);
-    // atlas_.AddSubMap(old_time, start_time, end_time);
-    // adapt::Problem problem;
-    // BuildProblem(active_kfs, problem);
-
-    // update new submap frams
-    SE3d old_pose = (--new_submap_kfs.end())->second->pose;
+    Frames snapshot_kfs;
+    for (auto pair_kf : frames)
     {
-        // build new submap pose graph
-        adapt::Problem problem;
-        BuildProblem(new_submap_kfs, problem);
-
-        // relocate new submaps
-        std::map<double, double> score_table;
-        for (auto pair_kf : new_submap_kfs)
+        Frame::Ptr frame = pair_kf.second;
+        Frame::Ptr clone_frame = Frame::Ptr(new Frame());
+        clone_frame->id = frame->id;
+        clone_frame->time = frame->time;
+        clone_frame->pose = frame->pose;
+        clone_frame->weights = frame->weights;
+        clone_frame->features_left = frame->features_left;
+        clone_frame->descriptors = frame->descriptors;
+        clone_frame->feature_lidar = frame->feature_lidar;
+        clone_frame->feature_navsat = frame->feature_navsat;
+        if (frame->loop_closure)
         {
-            Relocate(pair_kf.second, pair_kf.second->loop_closure->frame_old);
-            score_table[-pair_kf.second->loop_closure->score] = pair_kf.first;
+            clone_frame->loop_closure = loop::LoopClosure::Ptr(new loop::LoopClosure(*frame->loop_closure));
         }
-        int max_num_relocated = 1;
-        for (auto pair : score_table)
+        snapshot_kfs[pair_kf.first] = clone_frame;
+    }
+    for (auto pair_kf : snapshot_kfs)
+    {
+        auto loop_closure = pair_kf.second->loop_closure;
+        if (loop_closure && snapshot_kfs.find(loop_closure->frame_old->time) != snapshot_kfs.end())
         {
-            if (max_num_relocated-- == 0)
-                break;
-            auto frame = new_submap_kfs[pair.second];
-            frame->loop_closure->relocated = true;
-            frame->pose = frame->loop_closure->relative_o_c * frame->loop_closure->frame_old->pose;
+            loop_closure->frame_old = snapshot_kfs[loop_closure->frame_old->time];
         }
+    }
+    return snapshot_kfs;
+}
 
-        BuildProblemWithLoop(new_submap_kfs, problem);
-        ceres::Solver::Options options;
-        options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
-        options.num_threads = 1;
-        ceres::Solver::Summary summary;
-        ceres::Solve(options, &problem, &summary);
-
-        for (auto pair_kf : new_submap_kfs)
+void LoopDetector::CorrectLoop(double old_time, double start_time, double end_time)
+{
+    Frames origin_kfs, all_kfs;
+    {
+        // keyframes up to end_time may be in the active window, the backend changes them in Optimize
+        std::unique_lock<std::mutex> lock(backend_->mutex);
+        origin_kfs = Map::Instance().GetKeyFrames(old_time, end_time);
+        all_kfs = snapshot(origin_kfs);
+    }
+    std::map<double, SE3d> snapshot_poses;
+    for (auto pair_kf : all_kfs)
+    {
+        snapshot_poses[pair_kf.first] = pair_kf.second->pose;
+    }
+    SE3d old_pose = (--all_kfs.end())->second->pose;
+
+    // build the active pose graph, inner submaps are replaced by their first frames
+    Frames active_kfs = all_kfs;
+    std::map<double, SE3d> inner_old_frames = pose_graph_->GetActiveSubMaps(active_kfs, old_time, start_time);
+    pose_graph_->AddSubMap(old_time, start_time, end_time);
+    adapt::Problem problem;
+    pose_graph_->BuildProblem(active_kfs, problem);
+
+    // relocate new submaps
+    Frames new_submap_kfs(all_kfs.lower_bound(start_time), all_kfs.end());
+    std::map<double, double> score_table;
+    for (auto pair_kf : new_submap_kfs)
+    {
+        auto frame = pair_kf.second;
+        if (frame->loop_closure && Relocate(frame, frame->loop_closure->frame_old))
         {
-            Relocate(pair_kf.second, pair_kf.second->loop_closure->frame_old);
-            pair_kf.second->loop_closure->relocated = true;
-            pair_kf.second->pose = pair_kf.second->loop_closure->relative_o_c * pair_kf.second->loop_closure->frame_old->pose;
+            score_table[-frame->loop_closure->score] = pair_kf.first;
         }
     }
-    SE3d new_pose = (--new_submap_kfs.end())->second->pose;
+    int max_num_relocated = 1;
+    for (auto pair : score_table)
+    {
+        if (max_num_relocated-- == 0)
+            break;
+        auto frame = new_submap_kfs[pair.second];
+        frame->loop_closure->relocated = true;
+        frame->pose = frame->loop_closure->relative_o_c * frame->loop_closure->frame_old->pose;
+    }
 
-    // forward propogate
+    // optimize the whole active pose graph
+    BuildProblemWithLoop(active_kfs, problem);
+    pose_graph_->Optimize(all_kfs, active_kfs, problem, inner_old_frames);
+
+    for (auto pair_kf : new_submap_kfs)
     {
-        std::unique_lock<std::mutex> lock1(backend_->mutex);
-        std::unique_lock<std::mutex> lock2(frontend_->mutex);
+        auto frame = pair_kf.second;
+        if (frame->loop_closure && Relocate(frame, frame->loop_closure->frame_old))
+        {
+            frame->loop_closure->relocated = true;
+            frame->pose = frame->loop_closure->relative_o_c * frame->loop_closure->frame_old->pose;
+        }
+    }
 
-        Frame::Ptr last_frame = frontend_->last_frame;
-        Frames forward_kfs = Map::Instance().GetKeyFrames(end_time + epsilon);
-        if (forward_kfs.find(last_frame->time) == forward_kfs.end())
+    // publish the correction and let the backend apply it now
+    loop::Correction::Ptr correction = loop::Correction::Ptr(new loop::Correction());
+    correction->end_time = end_time;
+    correction->transform = (--all_kfs.end())->second->pose * old_pose.inverse();
+    for (auto pair_kf : all_kfs)
+    {
+        correction->deltas[pair_kf.first] = pair_kf.second->pose * snapshot_poses[pair_kf.first].inverse();
+        auto loop_closure = pair_kf.second->loop_closure;
+        if (loop_closure)
         {
-            forward_kfs[last_frame->time] = last_frame;
+            loop_closure->frame_old = origin_kfs.find(loop_closure->frame_old->time) != origin_kfs.end()
+                                          ? origin_kfs[loop_closure->frame_old->time]
+                                          : loop_closure->frame_old;
         }
-        SE3d transform = old_pose.inverse() * new_pose;
-        for (auto pair_kf : forward_kfs)
+    }
+    {
+        std::unique_lock<std::mutex> lock(backend_->mutex);
+        for (auto pair_kf : all_kfs)
         {
-            pair_kf.second->pose = pair_kf.second->pose * transform;
-            // TODO: Repropagate
-
-            if (mapping_)
-            {
-                mapping_->ToWorld(pair_kf.second);
-            }
+            origin_kfs[pair_kf.first]->loop_closure = pair_kf.second->loop_closure;
         }
-        frontend_->UpdateCache();
     }
-
-    // BuildProblemWithLoop(active_kfs, problem);
-    // ceres::Solver::Options options;
-    // options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
-    // options.num_threads = 1;
-    // ceres::Solver::Summary summary;
-    // ceres::Solve(options, &problem, &summary);
-
-    // // update pose of inner submaps
-    // for (auto pair_of : inner_submap_old_frames)
-    // {
-    //     auto old_frame = active_kfs[pair_of.first];
-    //     // T2_new = T2 * T1.inverse() * T1_new
-    //     SE3d transform = pair_of.second.inverse() * old_frame->pose;
-    //     for (auto iter = ++all_kfs.find(pair_of.first); active_kfs.find(iter->first) == active_kfs.end(); iter++)
-    //     {
-    //         auto frame = iter->second;
-    //         frame->pose = frame->pose * transform;
-    //     }
-    // }
-
-    // if (mapping_)
-    // {
-    //     for (auto pair_kf : all_kfs)
-    //     {
-    //         mapping_->AddToWorld(pair_kf.second);
-    //     }
-    // }
+    pose_graph_->Publish(correction);
+    backend_->ApplyCorrections();
 }
 
 } // namespace lvio_fusion
\ No newline at end of file
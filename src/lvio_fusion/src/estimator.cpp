@@ -70,6 +70,13 @@ bool Estimator::Init(int use_imu, int use_lidar, int use_navsat, int use_loop, i
 
     pose_graph = PoseGraph::Ptr(new PoseGraph);
     pose_graph->SetFrontend(frontend);
+    backend->SetPoseGraph(pose_graph);
+
+    trajectory = Trajectory::Ptr(new Trajectory(Config::Get<double>("path_window")));
+    backend->SetTrajectory(trajectory);
+
+    propagator = imu::Propagator::Ptr(new imu::Propagator(2000));
+    frontend->SetPropagator(propagator);
 
     if (use_loop)
     {
@@ -78,6 +85,24 @@ bool Estimator::Init(int use_imu, int use_lidar, int use_navsat, int use_loop, i
         detector->SetFrontend(frontend);
         detector->SetBackend(backend);
         detector->SetPoseGraph(pose_graph);
+        extractor = DescriptorExtractor::Ptr(new DescriptorExtractor(2));
+        frontend->SetDescriptorExtractor(extractor);
+        detector->SetDescriptorExtractor(extractor);
+        backend->SetLoopDetector(detector);
+    }
+
+    // an existing map file is loaded and continued when the first frame arrives
+    map_path_ = Config::Get<std::string>("map_path");
+    if (!map_path_.empty())
+    {
+        map_reader_ = MapReader::Open(map_path_);
+        if (!map_reader_ || map_reader_->EndTime() == 0)
+        {
+            map_reader_ = nullptr;
+            map_writer = MapWriter::Ptr(new MapWriter(map_path_));
+            map_writer->SetDescriptorExtractor(extractor);
+            backend->SetMapWriter(map_writer);
+        }
     }
 
     if (use_navsat)
@@ -89,7 +114,13 @@ bool Estimator::Init(int use_imu, int use_lidar, int use_navsat, int use_loop, i
 
     if (use_imu)
     {
-        Imu::Create(SE3d());
+        Imu::Create(SE3d(),
+                    Config::Get<double>("acc_n"),
+                    Config::Get<double>("acc_w"),
+                    Config::Get<double>("gyr_n"),
+                    Config::Get<double>("gyr_w"));
+        integrator = imu::Integrator::Ptr(new imu::Integrator(2000));
+        frontend->SetImuIntegrator(integrator);
         initializer = Initializer::Ptr(new Initializer);
         backend->SetInitializer(initializer);
         flags += Flag::IMU;
@@ -116,9 +147,13 @@ bool Estimator::Init(int use_imu, int use_lidar, int use_navsat, int use_loop, i
             Config::Get<double>("cycle_time"),
             Config::Get<double>("min_range"),
             Config::Get<double>("max_range"),
-            Config::Get<int>("deskew")));
+            Config::Get<int>("deskew"),
+            Config::Get<int>("ring_order")));
 
-        mapping = Mapping::Ptr(new Mapping);
+        mapping = Mapping::Ptr(new Mapping(
+            Config::Get<double>("tile_size"),
+            Config::Get<int>("num_tiles"),
+            Config::Get<std::string>("tiles_path")));
         mapping->SetFeatureAssociation(association);
 
         backend->SetMapping(mapping);
@@ -141,8 +176,45 @@ bool Estimator::Init(int use_imu, int use_lidar, int use_navsat, int use_loop, i
     return true;
 }
 
+/**
+ * load the saved map before the first frame, keyframes of the map are finalized
+ * @param time      time of the first frame, the saved map must end before it
+ */
+void Estimator::LoadMap(double time)
+{
+    MapReader::Ptr map_reader = map_reader_;
+    map_reader_ = nullptr;
+    if (map_reader->EndTime() >= time)
+    {
+        // the map is kept unchanged, this session is neither aligned with it nor appended to it
+        LOG(WARNING) << "The loaded map ends at " << std::to_string(map_reader->EndTime())
+                     << ", it is not aligned with the new session starting at " << std::to_string(time)
+                     << ", so it is not used.";
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(backend->mutex);
+    Frames kfs = map_reader->LoadKeyFrames();
+    if (!kfs.empty())
+    {
+        backend->head = kfs.rbegin()->first + epsilon;
+        if (mapping)
+        {
+            mapping->AddToGlobalMap(kfs);
+        }
+    }
+    map_writer = MapWriter::Ptr(new MapWriter(map_path_, map_reader->Size()));
+    map_writer->SetDescriptorExtractor(extractor);
+    backend->SetMapWriter(map_writer);
+}
+
 void Estimator::InputImage(double time, cv::Mat &left_image, cv::Mat &right_image, std::vector<DetectedObject> objects)
 {
+    if (map_reader_)
+    {
+        LoadMap(time);
+    }
+
     Frame::Ptr new_frame = Frame::Create();
     new_frame->time = time;
     new_frame->image_left = left_image;
@@ -157,10 +229,10 @@ void Estimator::InputImage(double time, cv::Mat &left_image, cv::Mat &right_imag
     LOG(INFO) << "VO status:" << (success ? "success" : "failed") << ",VO cost time: " << time_used.count() << " seconds.";
 }
 
-void Estimator::InputPointCloud(double time, Point3Cloud::Ptr point_cloud)
+void Estimator::InputPointCloud(double time, PointICloud::Ptr point_cloud, bool has_time, bool has_ring)
 {
     auto t1 = std::chrono::steady_clock::now();
-    association->AddScan(time, point_cloud);
+    association->AddScan(time, point_cloud, has_time, has_ring);
     auto t2 = std::chrono::steady_clock::now();
     auto time_used =
         std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1);
@@ -170,7 +242,11 @@ void Estimator::InputPointCloud(double time, Point3Cloud::Ptr point_cloud)
 
 void Estimator::InputIMU(double time, Vector3d acc, Vector3d gyr)
 {
-    frontend->AddImu(time, acc, gyr);
+    if (integrator)
+    {
+        integrator->AddImu(time, acc, gyr);
+    }
+    propagator->AddImu(time, acc, gyr);
 }
 
 void Estimator::InputNavSat(double time, double x, double y, double z, double posAccuracy)
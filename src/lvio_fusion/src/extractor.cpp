@@ -0,0 +1,70 @@
+#include "lvio_fusion/visual/extractor.h"
+
+namespace lvio_fusion
+{
+
+DescriptorExtractor::DescriptorExtractor(int num_threads)
+{
+    for (int i = 0; i < num_threads; i++)
+    {
+        threads_.push_back(std::thread(std::bind(&DescriptorExtractor::ExtractorLoop, this)));
+    }
+}
+
+/**
+ * add a new keyframe, keypoints are copied here because the backend may remove features later
+ * @param frame     new keyframe
+ */
+void DescriptorExtractor::Add(Frame::Ptr frame)
+{
+    // class_id of keypoints is the id of landmark, so that rows removed by orb are not mismatched
+    std::vector<cv::KeyPoint> keypoints;
+    for (auto pair_feature : frame->features_left)
+    {
+        keypoints.push_back(cv::KeyPoint(pair_feature.second->keypoint, 1, -1, 0, 0, pair_feature.first));
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    pending_ids_.insert(frame->id);
+    frames_.push(std::make_pair(frame, keypoints));
+    new_frame_.notify_one();
+}
+
+void DescriptorExtractor::Wait(Frame::Ptr frame)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_.wait(lock, [&] { return pending_ids_.find(frame->id) == pending_ids_.end(); });
+}
+
+void DescriptorExtractor::ExtractorLoop()
+{
+    cv::Ptr<cv::Feature2D> detector = cv::ORB::create();
+    while (true)
+    {
+        Frame::Ptr frame;
+        std::vector<cv::KeyPoint> keypoints;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            new_frame_.wait(lock, [this] { return !frames_.empty(); });
+            frame = frames_.front().first;
+            keypoints.swap(frames_.front().second);
+            frames_.pop();
+        }
+
+        cv::Mat descriptors;
+        detector->compute(frame->image_left, keypoints, descriptors);
+
+        std::map<unsigned long, cv::Mat> new_descriptors;
+        for (int i = 0; i < descriptors.rows; i++)
+        {
+            new_descriptors[keypoints[i].class_id] = descriptors.row(i).clone();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        frame->descriptors = new_descriptors;
+        pending_ids_.erase(frame->id);
+        finished_.notify_all();
+    }
+}
+
+} // namespace lvio_fusion
@@ -1,6 +1,7 @@
 #include "lvio_fusion/frontend.h"
 #include "lvio_fusion/backend.h"
 #include "lvio_fusion/config.h"
+#include "lvio_fusion/imu/imu.h"
 #include "lvio_fusion/map.h"
 #include "lvio_fusion/utility.h"
 #include "lvio_fusion/visual/camera.h"
@@ -22,6 +23,7 @@ bool Frontend::AddFrame(lvio_fusion::Frame::Ptr frame)
 {
     std::unique_lock<std::mutex> lock(mutex);
     current_frame = frame;
+    Preintegrate();
 
     switch (status)
     {
@@ -52,49 +54,112 @@ bool Frontend::AddFrame(lvio_fusion::Frame::Ptr frame)
     }
     last_frame = current_frame;
     last_frame_pose_cache_ = last_frame->pose;
+    UpdatePropagator();
     return true;
 }
 
-void Frontend::AddImu(double time, Vector3d acc, Vector3d gyr)
+// biases optimized by the backend are stored in the preintegrations of keyframes
+inline void key_frame_biases(Frame::Ptr key_frame, Vector3d &ba, Vector3d &bg)
 {
-    static double current_imu_time = 0;
-    static bool first = true;
-    static Vector3d acc0(0, 0, 0), gyr0(0, 0, 0), R(0, 0, 0), T(0, 0, 0), V(0, 0, 0);
-    double dt = time - current_imu_time;
-    current_imu_time = time;
-    if (current_frame)
+    if (key_frame && key_frame->preintegration)
     {
-        if (first)
-        {
-            first = false;
-            acc0 = acc;
-            gyr0 = gyr;
-        }
-        if (!current_frame->preintegration)
-        {
-            Vector3d ba = Vector3d::Zero(), bg = Vector3d::Zero(), v0 = Vector3d::Zero();
-            if (last_frame && last_frame->preintegration)
-            {
-                ba = last_frame->preintegration->linearized_ba;
-                bg = last_frame->preintegration->linearized_bg;
-                v0 = last_frame->preintegration->v0 + last_frame->preintegration->delta_v;
-            }
-            current_frame->preintegration = imu::Preintegration::Create(acc0, gyr0, v0, ba, bg);
-        }
-        current_frame->preintegration->Append(dt, acc, gyr);
-        if (current_key_frame && current_key_frame->preintegration && current_key_frame != current_frame)
+        ba = key_frame->preintegration->ba;
+        bg = key_frame->preintegration->bg;
+    }
+}
+
+/**
+ * the preintegration of a frame is from this frame to the next frame,
+ * and the preintegration of a keyframe is from this keyframe to the next keyframe.
+ * imu data may lag behind images, so segments are integrated in order once imu data covers them.
+ */
+void Frontend::Preintegrate()
+{
+    if (!integrator_ || !last_frame)
+        return;
+
+    pending_segments_.push_back({last_frame, current_frame, current_key_frame});
+    while (!pending_segments_.empty())
+    {
+        Segment &segment = pending_segments_.front();
+        Vector3d ba = Vector3d::Zero(), bg = Vector3d::Zero();
+        key_frame_biases(last_segment_key_frame_, ba, bg);
+        Vector3d v0 = Vector3d::Zero();
+        Velocity(segment.start->time, v0);
+        auto preintegration = integrator_->Integrate(segment.start->time, segment.end->time, v0, ba, bg);
+        if (!preintegration)
+            break;
+
+        segment.start->preintegration = preintegration;
+        if (segment.key_frame && segment.key_frame != segment.start && segment.key_frame->preintegration)
         {
-            current_key_frame->preintegration->Append(dt, acc, gyr);
+            segment.key_frame->preintegration->Merge(preintegration);
         }
-        acc0 = acc;
-        gyr0 = acc;
+        last_segment_key_frame_ = segment.key_frame;
+        pending_segments_.pop_front();
+    }
+
+    // imu data stops, the oldest segment is given up
+    if (pending_segments_.size() > max_pending_segments_)
+    {
+        LOG(WARNING) << "No imu data for frame " << pending_segments_.front().start->id;
+        pending_segments_.pop_front();
+        last_segment_key_frame_ = nullptr;
+    }
+}
+
+/**
+ * velocity in the world frame at time, propagated from the optimized state of the keyframe whose preintegration ends at time,
+ * V_j = V_i + R_wb_i * dv - g * dt
+ * @param time      time of the start frame of a segment
+ * @param velocity  output, unchanged if it is unknown
+ * @return whether the velocity is known, false before the imu is initialized
+ */
+bool Frontend::Velocity(double time, Vector3d &velocity)
+{
+    if (!Imu::Get()->initialized || !last_segment_key_frame_)
+        return false;
+    auto preintegration = last_segment_key_frame_->preintegration;
+    if (!preintegration || fabs(last_segment_key_frame_->time + preintegration->sum_dt - time) > epsilon)
+        return false;
+    SO3d R_wb = last_segment_key_frame_->pose.so3() * Imu::Get()->extrinsic.so3();
+    velocity = preintegration->v0 + R_wb * preintegration->delta_v - imu::g * preintegration->sum_dt;
+    return true;
+}
+
+// only well tracked frames are output
+void Frontend::UpdatePropagator()
+{
+    if (!propagator_)
+        return;
+
+    if (status == FrontendStatus::TRACKING_GOOD)
+    {
+        Vector3d ba = Vector3d::Zero(), bg = Vector3d::Zero();
+        key_frame_biases(last_segment_key_frame_, ba, bg);
+        key_frame_biases(current_key_frame, ba, bg);
+        Vector3d velocity = Vector3d::Zero();
+        bool has_velocity = integrator_ && Velocity(current_frame->time, velocity);
+        propagator_->SetState(current_frame->time, current_frame->pose, ba, bg, has_velocity ? &velocity : nullptr);
+    }
+    else
+    {
+        propagator_->Reset();
     }
 }
 
 bool Frontend::Track()
 {
     current_frame->pose = relative_i_j * last_frame_pose_cache_;
-    TrackLastFrame();
+    // the rotation integrated by the gyroscope is more accurate than the constant velocity model
+    bool imu_prior = Imu::Num() && last_frame->preintegration;
+    if (imu_prior)
+    {
+        SO3d R_bi = Imu::Get()->extrinsic.so3();
+        SO3d delta_R = R_bi * SO3d(last_frame->preintegration->delta_q) * R_bi.inverse();
+        current_frame->pose.so3() = last_frame_pose_cache_.so3() * delta_R;
+    }
+    TrackLastFrame(imu_prior);
     int num_inliers = current_frame->features_left.size();
 
     static int num_tries = 0;
@@ -159,6 +224,10 @@ void Frontend::CreateKeyframe(bool need_new_features)
     // insert!
     Map::Instance().InsertKeyFrame(current_frame);
     current_key_frame = current_frame;
+    if (extractor_)
+    {
+        extractor_->Add(current_frame);
+    }
     LOG(INFO) << "Add a keyframe " << current_frame->id;
     // update backend because we have a new keyframe
     backend_.lock()->UpdateMap();
@@ -173,18 +242,19 @@ inline double distance(cv::Point2f &pt1, cv::Point2f &pt2)
 
 inline void calcOpticalFlowPyrLK(cv::Mat &prevImg, cv::Mat &nextImg,
                                  std::vector<cv::Point2f> &prevPts, std::vector<cv::Point2f> &nextPts,
-                                 std::vector<uchar> &status, cv::Mat &err)
+                                 std::vector<uchar> &status, cv::Mat &err,
+                                 int max_level = 3, int max_iterations = 30)
 {
     cv::calcOpticalFlowPyrLK(
-        prevImg, nextImg, prevPts, nextPts, status, err, cv::Size(11, 11), 3,
-        cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01),
+        prevImg, nextImg, prevPts, nextPts, status, err, cv::Size(11, 11), max_level,
+        cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, max_iterations, 0.01),
         cv::OPTFLOW_USE_INITIAL_FLOW);
 
     std::vector<uchar> reverse_status;
     std::vector<cv::Point2f> reverse_pts = prevPts;
     cv::calcOpticalFlowPyrLK(
         nextImg, prevImg, nextPts, reverse_pts, reverse_status, err, cv::Size(11, 11), 1,
-        cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01),
+        cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, max_iterations, 0.01),
         cv::OPTFLOW_USE_INITIAL_FLOW);
 
     for (size_t i = 0; i < status.size(); i++)
@@ -202,7 +272,12 @@ inline void calcOpticalFlowPyrLK(cv::Mat &prevImg, cv::Mat &nextImg,
     }
 }
 
-int Frontend::TrackLastFrame()
+/**
+ * track features of the last frame, the initial positions are projected with the predicted pose
+ * @param imu_prior     the predicted pose is good enough for a coarse search
+ * @return number of tracked features
+ */
+int Frontend::TrackLastFrame(bool imu_prior)
 {
     // use LK flow to estimate points in the last image
     std::vector<cv::Point2f> kps_last, kps_current;
@@ -220,7 +295,10 @@ int Frontend::TrackLastFrame()
 
     std::vector<uchar> status;
     cv::Mat error;
-    calcOpticalFlowPyrLK(last_frame->image_left, current_frame->image_left, kps_last, kps_current, status, error);
+    int max_level = imu_prior ? 1 : 3;
+    int max_iterations = imu_prior ? 10 : 30;
+    calcOpticalFlowPyrLK(last_frame->image_left, current_frame->image_left, kps_last, kps_current, status, error,
+                         max_level, max_iterations);
 
     // Solve PnP
     std::vector<cv::Point3f> points_3d;
@@ -286,6 +364,10 @@ bool Frontend::InitMap()
 
     // the first frame is a keyframe
     Map::Instance().InsertKeyFrame(current_frame);
+    if (extractor_)
+    {
+        extractor_->Add(current_frame);
+    }
     LOG(INFO) << "Initial map created with " << num_new_features << " map points";
 
     // update backend and loop because we have a new keyframe
@@ -357,6 +439,8 @@ bool Frontend::Reset()
     backend_.lock()->Pause();
     Map::Instance().Reset();
     backend_.lock()->Continue();
+    pending_segments_.clear();
+    last_segment_key_frame_ = nullptr;
     status = FrontendStatus::BUILDING;
     LOG(INFO) << "Reset Succeed";
     return true;
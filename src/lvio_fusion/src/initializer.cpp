@@ -4,270 +4,189 @@
 
 namespace lvio_fusion
 {
+
+/**
+ * initialize imu with visual keyframes: gyroscope bias, velocities, gravity and scale
+ * @param kfs   continuous keyframes, the preintegration of the last keyframe may be unfinished
+ * @return whether the initialization is successful
+ */
 bool Initializer::Initialize(Frames kfs)
 {
+    auto t1 = std::chrono::steady_clock::now();
     // be perpare for initialization
     std::vector<Initializer::Frame> frames;
     for (auto pair_kf : kfs)
     {
-        if (!pair_kf.second->preintegration)
-            return false;
         Initializer::Frame frame;
         frame.preintegration = pair_kf.second->preintegration;
-        frame.R = pair_kf.second->pose.inverse().rotationMatrix();
-        frame.T = pair_kf.second->pose.inverse().translation();
-        frame.Ba = pair_kf.second->preintegration->linearized_ba;
-        frame.Bg = pair_kf.second->preintegration->linearized_bg;
+        frame.R = pair_kf.second->pose.rotationMatrix();
+        frame.T = pair_kf.second->pose.translation();
+        frame.Ba = Vector3d::Zero();
+        frame.Bg = Vector3d::Zero();
+        if (frame.preintegration)
+        {
+            frame.Bg = frame.preintegration->linearized_bg;
+        }
+        else if (frames.size() + 1 < kfs.size())
+        {
+            return false;
+        }
         frames.push_back(frame);
     }
+    if (frames.size() < 3)
+        return false;
 
     SolveGyroscopeBias(frames);
-    for (auto frame : frames)
+
+    VectorXd x;
+    bool success = LinearAlignment(frames, x);
+    if (success)
+    {
+        RefineGravity(frames, x);
+        // the map of stereo is metric, so the scale only checks the alignment
+        double s = x.tail<1>()(0);
+        success = fabs(s - 1) < 0.2;
+    }
+
+    auto t2 = std::chrono::steady_clock::now();
+    auto time_used = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1);
+    if (!success)
     {
-        frame.preintegration->Repropagate(Vector3d::Zero(), frame.Bg);
+        LOG(INFO) << "IMU Initialization failed, cost time: " << time_used.count() << " seconds.";
+        return false;
+    }
+
+    imu::g = g_;
+    for (int i = 0; i < frames.size(); i++)
+    {
+        if (frames[i].preintegration)
+        {
+            frames[i].preintegration->v0 = x.segment<3>(i * 3);
+        }
     }
-    LOG(INFO) << "IMU Initialization failed.";
     initialized = true;
+    LOG(INFO) << "IMU Initialization succeeded, cost time: " << time_used.count() << " seconds.";
+    LOG(INFO) << "g: " << g_.transpose() << ", scale: " << x.tail<1>()(0) << ", bg: " << frames[0].Bg.transpose();
     return true;
-    // //check imu observibility
-    // Frames::iterator frame_it;
-    // Vector3d sum_g;
-    // for (frame_it = frames_.begin(); next(frame_it) != frames_.end(); frame_it++)
-    // {
-    //     double dt = frame_it->second->preintegration->sum_dt;
-    //     Vector3d tmp_g = frame_it->second->preintegration->delta_v / dt;
-    //     sum_g += tmp_g;
-    // }
-    // Vector3d aver_g;
-    // aver_g = sum_g * 1.0 / ((int)frames_.size() - 1);
-    // double var = 0;
-    // for (frame_it = frames_.begin(); next(frame_it) != frames_.end(); frame_it++)
-    // {
-    //     double dt = frame_it->second->preintegration->sum_dt;
-    //     Vector3d tmp_g = frame_it->second->preintegration->delta_v / dt;
-    //     var += (tmp_g - aver_g).transpose() * (tmp_g - aver_g);
-    // }
-    // var = sqrt(var / ((int)frames_.size() - 1));
-    // if (var < 0.25)
-    // {
-    //     LOG(INFO) << "IMU excitation not enouth!";
-    //     return false;
-    // }
-
-    // // visual initial align
-    // if (VisualInitialAlign())
-    //     return true;
-    // else
-    // {
-    //     LOG(INFO) << "misalign visual structure with IMU";
-    //     return false;
-    // }
 }
 
-// bool Initializer::VisualInitialAlign()
-// {
-//     VectorXd x;
-//     //solve scale
-//     bool result = VisualIMUAlignment(x);
-//     if (!result)
-//     {
-//         //ROS_DEBUG("solve g_ failed!");
-//         return false;
-//     }
-
-//     double s = (x.tail<1>())(0);
-//     Frames::iterator frame_i;
-//     for (frame_i = frames_.begin(); frame_i != frames_.end(); frame_i++)
-//     {
-//         frame_i->second->preintegration->Repropagate(Vector3d::Zero(), frame_i->second->preintegration->Bg);
-//     }
-
-//     Matrix3d R0 = g2R(g_);
-//     double yaw = R2ypr(R0 * frames_.begin()->second->pose.rotationMatrix()).x();
-//     R0 = ypr2R(Vector3d{-yaw, 0, 0}) * R0;
-//     g_ = R0 * g_;
-
-//     Matrix3d rot_diff = R0;
-
-//     return true;
-// }
-
 void Initializer::SolveGyroscopeBias(std::vector<Initializer::Frame> &frames)
 {
     Matrix3d A = Matrix3d::Zero();
     Vector3d b = Vector3d::Zero();
     Vector3d delta_bg;
 
-    for (int i = 0, j = 1; j < frames.size() - 1; i++, j++)
+    for (int i = 0, j = 1; j < frames.size(); i++, j++)
     {
-        MatrixXd tmp_A(3, 3);
-        tmp_A.setZero();
-        VectorXd tmp_b(3);
-        tmp_b.setZero();
         Quaterniond q_ij(frames[i].R.transpose() * frames[j].R);
-        tmp_A = frames[i].preintegration->jacobian.template block<3, 3>(imu::O_R, imu::O_BG);
-        tmp_b = 2 * (frames[i].preintegration->delta_q.inverse() * q_ij).vec();
+        Matrix3d tmp_A = frames[i].preintegration->dq_dbg();
+        Vector3d tmp_b = 2 * (frames[i].preintegration->delta_q.inverse() * q_ij).vec();
         A += tmp_A.transpose() * tmp_A;
         b += tmp_A.transpose() * tmp_b;
     }
     delta_bg = A.ldlt().solve(b);
 
-    for (int i = 0; i < frames.size() - 1; i++)
+    // the unfinished preintegration of the last keyframe is corrected too, it is continued by the frontend
+    for (int i = 0; i < frames.size(); i++)
     {
         frames[i].Bg += delta_bg;
-        frames[i].preintegration->Repropagate(Vector3d::Zero(), frames[0].Bg);
+        if (frames[i].preintegration)
+        {
+            frames[i].preintegration->Correct(Vector3d::Zero(), frames[i].Bg);
+            frames[i].preintegration->ba = Vector3d::Zero();
+            frames[i].preintegration->bg = frames[i].Bg;
+        }
     }
 }
 
-// inline MatrixXd TangentBasis(Vector3d &g0)
-// {
-//     Vector3d b, c;
-//     Vector3d a = g0.normalized();
-//     Vector3d tmp(0, 0, 1);
-//     if (a == tmp)
-//         tmp << 1, 0, 0;
-//     b = (tmp - a * (a.transpose() * tmp)).normalized();
-//     c = a.cross(b);
-//     MatrixXd bc(3, 2);
-//     bc.block<3, 1>(0, 0) = b;
-//     bc.block<3, 1>(0, 1) = c;
-//     return bc;
-// }
-
-// void Initializer::RefineGravity(VectorXd &x)
-// {
-//     Vector3d g0 = g_.normalized() * imu::g.norm();
-//     Vector3d lx, ly;
-//     int all_frame_count = frames_.size();
-//     int n_state = all_frame_count * 3 + 2 + 1;
-
-//     MatrixXd A{n_state, n_state};
-//     A.setZero();
-//     VectorXd b{n_state};
-//     b.setZero();
-
-//     Frames::iterator frame_i;
-//     Frames::iterator frame_j;
-//     for (int k = 0; k < 4; k++)
-//     {
-//         MatrixXd lxly(3, 2);
-//         lxly = TangentBasis(g0);
-//         int i = 0;
-//         for (frame_i = frames_.begin(); next(frame_i) != frames_.end(); frame_i++, i++)
-//         {
-//             frame_j = next(frame_i);
-
-//             MatrixXd tmp_A(6, 9);
-//             tmp_A.setZero();
-//             VectorXd tmp_b(6);
-//             tmp_b.setZero();
-
-//             double dt = frame_i->second->preintegration->sum_dt;
-
-//             tmp_A.block<3, 3>(0, 0) = -dt * Matrix3d::Identity();
-//             tmp_A.block<3, 2>(0, 6) = frame_i->second->pose.rotationMatrix() * dt * dt / 2 * Matrix3d::Identity() * lxly;
-//             tmp_A.block<3, 1>(0, 8) = frame_i->second->pose.rotationMatrix() * (frame_j->second->pose.inverse().translation() - frame_i->second->pose.inverse().translation()) / 100.0;
-//             tmp_b.block<3, 1>(0, 0) = frame_i->second->preintegration->delta_p - frame_i->second->pose.rotationMatrix() * dt * dt / 2 * g0;
-
-//             tmp_A.block<3, 3>(3, 0) = -Matrix3d::Identity();
-//             tmp_A.block<3, 3>(3, 3) = frame_i->second->pose.rotationMatrix() * frame_j->second->pose.rotationMatrix().transpose();
-//             tmp_A.block<3, 2>(3, 6) = frame_i->second->pose.rotationMatrix() * dt * Matrix3d::Identity() * lxly;
-//             tmp_b.block<3, 1>(3, 0) = frame_i->second->preintegration->delta_v - frame_i->second->pose.rotationMatrix() * dt * Matrix3d::Identity() * g0;
-
-//             // NOTE: remove useless cov_inv
-//             MatrixXd r_A = tmp_A.transpose() * tmp_A;
-//             VectorXd r_b = tmp_A.transpose() * tmp_b;
-
-//             A.block<6, 6>(i * 3, i * 3) += r_A.topLeftCorner<6, 6>();
-//             b.segment<6>(i * 3) += r_b.head<6>();
-
-//             A.bottomRightCorner<3, 3>() += r_A.bottomRightCorner<3, 3>();
-//             b.tail<3>() += r_b.tail<3>();
-
-//             A.block<6, 3>(i * 3, n_state - 3) += r_A.topRightCorner<6, 3>();
-//             A.block<3, 6>(n_state - 3, i * 3) += r_A.bottomLeftCorner<3, 6>();
-//         }
-//         A = A * 1000.0;
-//         b = b * 1000.0;
-//         x = A.ldlt().solve(b);
-//         VectorXd dg = x.segment<2>(n_state - 3);
-//         g0 = (g0 + lxly * dg).normalized() * imu::g.norm();
-//     }
-//     g_ = g0;
-// }
-
-// bool Initializer::LinearAlignment(VectorXd &x)
-// {
-//     int all_frame_count = frames_.size();
-//     int n_state = all_frame_count * 3 + 3 + 1;
-
-//     MatrixXd A{n_state, n_state};
-//     A.setZero();
-//     VectorXd b{n_state};
-//     b.setZero();
-
-//     Frames::iterator frame_i;
-//     Frames::iterator frame_j;
-//     int i = 0;
-//     for (frame_i = frames_.begin(); next(frame_i) != frames_.end(); frame_i++, i++)
-//     {
-//         frame_j = next(frame_i);
-
-//         MatrixXd tmp_A(6, 10);
-//         tmp_A.setZero();
-//         VectorXd tmp_b(6);
-//         tmp_b.setZero();
-
-//         double dt = frame_i->second->preintegration->sum_dt;
-
-//         tmp_A.block<3, 3>(0, 0) = -dt * Matrix3d::Identity();
-//         tmp_A.block<3, 3>(0, 6) = frame_i->second->pose.rotationMatrix() * dt * dt / 2 * Matrix3d::Identity();
-//         tmp_A.block<3, 1>(0, 9) = frame_i->second->pose.rotationMatrix() * (frame_j->second->pose.inverse().translation() - frame_i->second->pose.inverse().translation()) / 100.0;
-//         tmp_b.block<3, 1>(0, 0) = frame_i->second->preintegration->delta_p;
-//         tmp_A.block<3, 3>(3, 0) = -Matrix3d::Identity();
-//         tmp_A.block<3, 3>(3, 3) = frame_i->second->pose.rotationMatrix() * frame_j->second->pose.rotationMatrix().transpose();
-//         tmp_A.block<3, 3>(3, 6) = frame_i->second->pose.rotationMatrix() * dt * Matrix3d::Identity();
-//         tmp_b.block<3, 1>(3, 0) = frame_i->second->preintegration->delta_v;
-
-//         // NOTE: remove useless con_inv
-//         MatrixXd r_A = tmp_A.transpose() * tmp_A;
-//         VectorXd r_b = tmp_A.transpose() * tmp_b;
-
-//         A.block<6, 6>(i * 3, i * 3) += r_A.topLeftCorner<6, 6>();
-//         b.segment<6>(i * 3) += r_b.head<6>();
-
-//         A.bottomRightCorner<4, 4>() += r_A.bottomRightCorner<4, 4>();
-//         b.tail<4>() += r_b.tail<4>();
+/**
+ * linear system of velocities, gravity and scale in the world frame,
+ * R_i * dp = s * (T_j - T_i) - V_i * dt + 0.5 * g * dt^2
+ * R_i * dv = V_j - V_i + g * dt
+ * @param frames
+ * @param A     columns are [V_0 ... V_n-1, g, s]
+ * @param b
+ */
+inline void build_alignment(std::vector<Initializer::Frame> &frames, MatrixXd &A, VectorXd &b)
+{
+    int n = frames.size();
+    A.setZero(6 * (n - 1), 3 * n + 4);
+    b.setZero(6 * (n - 1));
+    for (int i = 0, j = 1; j < n; i++, j++)
+    {
+        auto preintegration = frames[i].preintegration;
+        double dt = preintegration->sum_dt;
+        int row = 6 * i;
+        A.block<3, 3>(row, 3 * i) = -dt * Matrix3d::Identity();
+        A.block<3, 3>(row, 3 * n) = 0.5 * dt * dt * Matrix3d::Identity();
+        A.block<3, 1>(row, 3 * n + 3) = frames[j].T - frames[i].T;
+        b.segment<3>(row) = frames[i].R * preintegration->delta_p;
+
+        A.block<3, 3>(row + 3, 3 * i) = -Matrix3d::Identity();
+        A.block<3, 3>(row + 3, 3 * j) = Matrix3d::Identity();
+        A.block<3, 3>(row + 3, 3 * n) = dt * Matrix3d::Identity();
+        b.segment<3>(row + 3) = frames[i].R * preintegration->delta_v;
+    }
+}
 
-//         A.block<6, 4>(i * 3, n_state - 4) += r_A.topRightCorner<6, 4>();
-//         A.block<4, 6>(n_state - 4, i * 3) += r_A.bottomLeftCorner<4, 6>();
-//     }
-//     A = A * 1000.0;
-//     b = b * 1000.0;
-//     x = A.ldlt().solve(b);
-//     double s = x(n_state - 1) / 100.0; //scale
-//     g_ = x.segment<3>(n_state - 4);    // g_
-//     if (fabs(g_.norm() - imu::g.norm()) > 1.0 || s < 0)
-//     {
-//         return false;
-//     }
+bool Initializer::LinearAlignment(std::vector<Initializer::Frame> &frames, VectorXd &x)
+{
+    MatrixXd A;
+    VectorXd b;
+    build_alignment(frames, A, b);
+    x = A.colPivHouseholderQr().solve(b);
+
+    int n = frames.size();
+    double s = x(3 * n + 3);
+    g_ = x.segment<3>(3 * n);
+    return fabs(g_.norm() - imu::g.norm()) < 1.0 && s > 0;
+}
 
-//     RefineGravity(x);
-//     s = (x.tail<1>())(0) / 100.0;
-//     (x.tail<1>())(0) = s;
-//     if (s < 0.0)
-//         return false;
-//     else
-//         return true;
-// }
+inline Matrix<double, 3, 2> tangent_basis(const Vector3d &g0)
+{
+    Vector3d a = g0.normalized();
+    Vector3d tmp(0, 0, 1);
+    if (fabs(a.dot(tmp)) > 0.9)
+    {
+        tmp << 1, 0, 0;
+    }
+    Vector3d b = (tmp - a * a.dot(tmp)).normalized();
+    Vector3d c = a.cross(b);
+    Matrix<double, 3, 2> bc;
+    bc << b, c;
+    return bc;
+}
 
-// bool Initializer::VisualIMUAlignment(VectorXd &x)
-// {
-//     SolveGyroscopeBias();
+/**
+ * refine gravity on its tangent space with the known magnitude
+ * @param frames
+ * @param x         result of LinearAlignment, [V_0 ... V_n-1, g, s]
+ */
+void Initializer::RefineGravity(std::vector<Initializer::Frame> &frames, VectorXd &x)
+{
+    int n = frames.size();
+    MatrixXd A_full;
+    VectorXd b_full;
+    build_alignment(frames, A_full, b_full);
+    MatrixXd A_g = A_full.middleCols<3>(3 * n);
+
+    Vector3d g0 = g_.normalized() * imu::g.norm();
+    MatrixXd A(A_full.rows(), 3 * n + 3);
+    A.leftCols(3 * n) = A_full.leftCols(3 * n);
+    A.rightCols<1>() = A_full.rightCols<1>();
+    VectorXd y;
+    for (int k = 0; k < 4; k++)
+    {
+        Matrix<double, 3, 2> lxly = tangent_basis(g0);
+        A.middleCols<2>(3 * n) = A_g * lxly;
+        VectorXd b = b_full - A_g * g0;
+        y = A.colPivHouseholderQr().solve(b);
+        g0 = (g0 + lxly * y.segment<2>(3 * n)).normalized() * imu::g.norm();
+    }
+    g_ = g0;
+    x.head(3 * n) = y.head(3 * n);
+    x.segment<3>(3 * n) = g_;
+    x(3 * n + 3) = y(3 * n + 2);
+}
 
-//     if (LinearAlignment(x))
-//         return true;
-//     else
-//         return false;
-// }
-} // namespace lvio_fusion
\ No newline at end of file
+} // namespace lvio_fusion
@@ -0,0 +1,67 @@
+#include "lvio_fusion/imu/integrator.h"
+
+namespace lvio_fusion
+{
+namespace imu
+{
+
+void Integrator::AddImu(double time, const Vector3d &acc, const Vector3d &gyr)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!buf_.empty() && time <= buf_.back().time)
+        return;
+    buf_.push_back({time, acc, gyr});
+    if (buf_.size() > capacity_)
+    {
+        buf_.pop_front();
+    }
+}
+
+// linear interpolation of the buffer at time, the caller holds mutex_ and ensures time <= the newest sample
+Measurement Integrator::Interpolate(double time)
+{
+    auto iter = std::lower_bound(buf_.begin(), buf_.end(), time,
+                                 [](const Measurement &m, double t) { return m.time < t; });
+    if (iter == buf_.begin())
+        return {time, iter->acc, iter->gyr};
+    auto prev = iter - 1;
+    double k = (time - prev->time) / (iter->time - prev->time);
+    return {time, (1 - k) * prev->acc + k * iter->acc, (1 - k) * prev->gyr + k * iter->gyr};
+}
+
+/**
+ * integrate samples in [start, end], boundary samples are interpolated so that segments can be merged
+ * @param start     time of the start frame
+ * @param end       time of the end frame
+ * @return preintegration, nullptr if imu data has not reached end yet, the caller should retry later
+ */
+Preintegration::Ptr Integrator::Integrate(double start, double end, const Vector3d &v0, const Vector3d &ba, const Vector3d &bg)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (buf_.empty() || start >= end || buf_.back().time < end)
+        return nullptr;
+
+    Measurement first = Interpolate(start), last = Interpolate(end);
+    Preintegration::Ptr preintegration = Preintegration::Create(first.acc, first.gyr, v0, ba, bg);
+    double time = start;
+    for (auto &m : buf_)
+    {
+        if (m.time <= start)
+            continue;
+        if (m.time >= end)
+            break;
+        preintegration->Append(m.time - time, m.acc, m.gyr);
+        time = m.time;
+    }
+    preintegration->Append(end - time, last.acc, last.gyr);
+
+    // samples before end are not needed any more, except the one for interpolation
+    while (buf_.size() > 1 && buf_[1].time <= end)
+    {
+        buf_.pop_front();
+    }
+    return preintegration;
+}
+
+} // namespace imu
+} // namespace lvio_fusion
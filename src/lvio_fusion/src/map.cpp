@@ -65,16 +65,28 @@ void Map::RemoveLandmark(visual::Landmark::Ptr landmark)
     landmarks.erase(landmark->id);
 }
 
+// interpolate the pose at the time with the two nearest keyframes, extrapolate out of the keyframes
 SE3d Map::ComputePose(double time)
 {
-    auto frame1 = keyframes.lower_bound(time)->second;
-    auto frame2 = keyframes.upper_bound(time)->second;
-    double d_t = time - frame1->time;
-    double t_t = frame2->time - frame1->time;
-    double s = d_t / t_t;
-    Quaterniond q = frame1->pose.unit_quaternion().slerp(s, frame2->pose.unit_quaternion());
+    std::unique_lock<std::mutex> lock(mutex_local_kfs);
+    assert(!keyframes.empty());
+    if (keyframes.size() == 1)
+        return keyframes.begin()->second->pose;
+    auto iter = keyframes.upper_bound(time);
+    if (iter == keyframes.begin())
+    {
+        iter++;
+    }
+    else if (iter == keyframes.end())
+    {
+        iter--;
+    }
+    auto frame2 = iter->second;
+    auto frame1 = (--iter)->second;
+    double s = (time - frame1->time) / (frame2->time - frame1->time);
+    SO3d r = frame1->pose.so3() * SO3d::exp(s * (frame1->pose.so3().inverse() * frame2->pose.so3()).log());
     Vector3d t = (1 - s) * frame1->pose.translation() + s * frame2->pose.translation();
-    return SE3d(q, t);
+    return SE3d(r, t);
 }
 
 } // namespace lvio_fusion
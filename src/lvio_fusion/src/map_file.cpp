@@ -0,0 +1,508 @@
+#include "lvio_fusion/map_file.h"
+#include "lvio_fusion/map.h"
+#include "lvio_fusion/visual/feature.h"
+#include "lvio_fusion/visual/landmark.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lvio_fusion
+{
+
+const size_t header_size = sizeof(map_file::magic) + 2 * sizeof(uint32_t);
+
+template <typename T>
+inline void put(std::vector<char> &buffer, const T &value)
+{
+    const char *p = reinterpret_cast<const char *>(&value);
+    buffer.insert(buffer.end(), p, p + sizeof(T));
+}
+
+inline void put_pose(std::vector<char> &buffer, const SE3d &pose)
+{
+    for (int i = 0; i < SE3d::num_parameters; i++)
+    {
+        put(buffer, pose.data()[i]);
+    }
+}
+
+// bounds checked reader of a payload
+class Cursor
+{
+public:
+    Cursor(const char *data, uint32_t size) : data_(data), end_(data + size) {}
+
+    template <typename T>
+    T Get()
+    {
+        T value;
+        if (data_ + sizeof(T) > end_)
+        {
+            ok = false;
+            memset(&value, 0, sizeof(T));
+            return value;
+        }
+        memcpy(&value, data_, sizeof(T));
+        data_ += sizeof(T);
+        return value;
+    }
+
+    SE3d GetPose()
+    {
+        SE3d pose;
+        for (int i = 0; i < SE3d::num_parameters; i++)
+        {
+            pose.data()[i] = Get<double>();
+        }
+        pose.so3().normalize();
+        return pose;
+    }
+
+    const char *Skip(size_t size)
+    {
+        const char *p = data_;
+        if (data_ + size > end_)
+        {
+            ok = false;
+            return nullptr;
+        }
+        data_ += size;
+        return p;
+    }
+
+    bool ok = true;
+
+private:
+    const char *data_;
+    const char *end_;
+};
+
+MapWriter::MapWriter(const std::string &path, size_t offset)
+{
+    // continue a loaded map file from its last complete chunk
+    if (offset > 0 && truncate(path.c_str(), offset) == 0)
+    {
+        file_.open(path, std::ios::binary | std::ios::app);
+    }
+    else
+    {
+        uint32_t reserved = 0;
+        file_.open(path, std::ios::binary | std::ios::trunc);
+        file_.write(map_file::magic, sizeof(map_file::magic));
+        file_.write(reinterpret_cast<const char *>(&map_file::version), sizeof(map_file::version));
+        file_.write(reinterpret_cast<const char *>(&reserved), sizeof(reserved));
+        file_.flush();
+    }
+    thread_ = std::thread(std::bind(&MapWriter::WriterLoop, this));
+}
+
+inline void put_chunk(std::vector<char> &buffer, uint32_t type, double time, const std::vector<char> &payload)
+{
+    map_file::ChunkHeader header;
+    header.type = type;
+    header.size = payload.size();
+    header.time = time;
+    put(buffer, header);
+    buffer.insert(buffer.end(), payload.begin(), payload.end());
+}
+
+// serialize all chunks of a keyframe except the descriptors, which are computed in other threads
+void put_keyframe(std::vector<char> &buffer, Frame::Ptr frame)
+{
+    std::vector<char> payload;
+    put(payload, (uint64_t)frame->id);
+    put_pose(payload, frame->pose);
+    put_chunk(buffer, map_file::KeyFrame, frame->time, payload);
+
+    std::vector<char> features, landmarks;
+    uint32_t num_features = 0, num_landmarks = 0;
+    for (auto pair_feature : frame->features_left)
+    {
+        auto feature = pair_feature.second;
+        put(features, (uint64_t)pair_feature.first);
+        put(features, feature->keypoint.x);
+        put(features, feature->keypoint.y);
+        num_features++;
+
+        // landmarks are saved with their first frames
+        auto landmark = feature->landmark.lock();
+        if (landmark && landmark->first_observation && landmark->first_observation->frame.lock() == frame)
+        {
+            put(landmarks, (uint64_t)landmark->id);
+            put(landmarks, landmark->position.x());
+            put(landmarks, landmark->position.y());
+            put(landmarks, landmark->position.z());
+            put(landmarks, landmark->first_observation->keypoint.x);
+            put(landmarks, landmark->first_observation->keypoint.y);
+            num_landmarks++;
+        }
+    }
+    payload.clear();
+    put(payload, num_landmarks);
+    payload.insert(payload.end(), landmarks.begin(), landmarks.end());
+    put_chunk(buffer, map_file::Landmarks, frame->time, payload);
+    payload.clear();
+    put(payload, num_features);
+    payload.insert(payload.end(), features.begin(), features.end());
+    put_chunk(buffer, map_file::Features, frame->time, payload);
+
+    if (frame->feature_lidar)
+    {
+        payload.clear();
+        auto &surf = frame->feature_lidar->points_surf;
+        auto &ground = frame->feature_lidar->points_ground;
+        put(payload, (uint32_t)surf.size());
+        put(payload, (uint32_t)ground.size());
+        for (auto pc : {&surf, &ground})
+        {
+            for (auto &point : pc->points)
+            {
+                put(payload, point.x);
+                put(payload, point.y);
+                put(payload, point.z);
+                put(payload, point.intensity);
+            }
+        }
+        put_chunk(buffer, map_file::Lidar, frame->time, payload);
+    }
+}
+
+/**
+ * queue finalized keyframes, they are serialized here because the backend may still
+ * correct their poses and features, so the caller must hold the lock of the backend
+ * @param kfs   finalized keyframes
+ */
+void MapWriter::AddKeyFrames(const Frames &kfs)
+{
+    if (kfs.empty())
+        return;
+    std::vector<std::pair<Frame::Ptr, std::vector<char>>> new_kfs;
+    for (auto pair_kf : kfs)
+    {
+        new_kfs.emplace_back(pair_kf.second, std::vector<char>());
+        put_keyframe(new_kfs.back().second, pair_kf.second);
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto &pair : new_kfs)
+    {
+        kfs_queue_.push_back(std::move(pair));
+    }
+    new_data_.notify_one();
+}
+
+// called by the owner of the poses, so the poses are copied here
+void MapWriter::UpdatePoses(const Frames &kfs)
+{
+    if (kfs.empty())
+        return;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto pair_kf : kfs)
+    {
+        poses_queue_[pair_kf.first] = pair_kf.second->pose;
+    }
+    new_data_.notify_one();
+}
+
+void MapWriter::WriterLoop()
+{
+    while (true)
+    {
+        std::vector<std::pair<Frame::Ptr, std::vector<char>>> kfs;
+        std::map<double, SE3d> poses;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            new_data_.wait(lock, [this] { return !kfs_queue_.empty() || !poses_queue_.empty(); });
+            kfs.swap(kfs_queue_);
+            poses.swap(poses_queue_);
+        }
+
+        for (auto &pair : kfs)
+        {
+            file_.write(pair.second.data(), pair.second.size());
+            WriteDescriptors(pair.first);
+        }
+        if (!poses.empty())
+        {
+            std::vector<char> payload;
+            put(payload, (uint32_t)poses.size());
+            for (auto pair : poses)
+            {
+                put(payload, pair.first);
+                put_pose(payload, pair.second);
+            }
+            WriteChunk(map_file::Poses, 0, payload);
+        }
+        // only complete chunks are visible to readers
+        file_.flush();
+    }
+}
+
+// descriptors are only written by the extractor, they are never changed after it finished
+void MapWriter::WriteDescriptors(Frame::Ptr frame)
+{
+    if (extractor_)
+    {
+        extractor_->Wait(frame);
+    }
+    if (frame->descriptors.empty())
+        return;
+
+    std::vector<char> payload;
+    put(payload, (uint32_t)frame->descriptors.size());
+    for (auto pair_descriptor : frame->descriptors)
+    {
+        put(payload, (uint64_t)pair_descriptor.first);
+        const char *p = reinterpret_cast<const char *>(pair_descriptor.second.data);
+        payload.insert(payload.end(), p, p + 32);
+    }
+    WriteChunk(map_file::Descriptors, frame->time, payload);
+}
+
+void MapWriter::WriteChunk(uint32_t type, double time, const std::vector<char> &payload)
+{
+    map_file::ChunkHeader header;
+    header.type = type;
+    header.size = payload.size();
+    header.time = time;
+    file_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file_.write(payload.data(), payload.size());
+}
+
+/**
+ * open a map file and index its chunks, the payloads are not decoded
+ * @param path      path of the map file
+ * @return reader, nullptr if the file is not a map of this version
+ */
+MapReader::Ptr MapReader::Open(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)header_size)
+    {
+        close(fd);
+        return nullptr;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return nullptr;
+
+    MapReader::Ptr reader(new MapReader);
+    reader->data_ = static_cast<const char *>(data);
+    reader->size_ = st.st_size;
+    uint32_t file_version;
+    memcpy(&file_version, reader->data_ + sizeof(map_file::magic), sizeof(file_version));
+    if (memcmp(reader->data_, map_file::magic, sizeof(map_file::magic)) != 0 || file_version != map_file::version)
+    {
+        LOG(WARNING) << "Unsupported map file: " << path;
+        return nullptr;
+    }
+
+    // a truncated chunk at the end is ignored
+    size_t offset = header_size;
+    while (offset + sizeof(map_file::ChunkHeader) <= reader->size_)
+    {
+        map_file::ChunkHeader header;
+        memcpy(&header, reader->data_ + offset, sizeof(header));
+        if (offset + sizeof(header) + header.size > reader->size_)
+            break;
+        if (header.type == map_file::Poses)
+        {
+            reader->poses_chunks_.push_back(offset);
+        }
+        else
+        {
+            reader->index_[header.time][header.type] = offset;
+        }
+        offset += sizeof(header) + header.size;
+    }
+    reader->valid_size_ = offset;
+    LOG(INFO) << "Open map file: " << path << ", keyframes: " << reader->index_.size();
+    return reader;
+}
+
+MapReader::~MapReader()
+{
+    if (data_)
+    {
+        munmap(const_cast<char *>(data_), size_);
+    }
+}
+
+const char *MapReader::Payload(double time, map_file::ChunkType type, uint32_t &size)
+{
+    auto iter = index_.find(time);
+    if (iter == index_.end())
+        return nullptr;
+    auto type_iter = iter->second.find(type);
+    if (type_iter == iter->second.end())
+        return nullptr;
+    map_file::ChunkHeader header;
+    memcpy(&header, data_ + type_iter->second, sizeof(header));
+    size = header.size;
+    return data_ + type_iter->second + sizeof(header);
+}
+
+// the latest poses of all keyframes, only keyframe and pose chunks are decoded
+std::map<double, SE3d> MapReader::GetPoses()
+{
+    std::map<double, std::pair<size_t, SE3d>> latest;
+    for (auto &pair : index_)
+    {
+        uint32_t size;
+        const char *payload = Payload(pair.first, map_file::KeyFrame, size);
+        if (!payload)
+            continue;
+        Cursor cursor(payload, size);
+        cursor.Get<uint64_t>();
+        SE3d pose = cursor.GetPose();
+        if (cursor.ok)
+        {
+            latest[pair.first] = std::make_pair(pair.second[map_file::KeyFrame], pose);
+        }
+    }
+    for (auto offset : poses_chunks_)
+    {
+        map_file::ChunkHeader header;
+        memcpy(&header, data_ + offset, sizeof(header));
+        Cursor cursor(data_ + offset + sizeof(header), header.size);
+        uint32_t n = cursor.Get<uint32_t>();
+        for (uint32_t i = 0; i < n && cursor.ok; i++)
+        {
+            double time = cursor.Get<double>();
+            SE3d pose = cursor.GetPose();
+            auto iter = latest.find(time);
+            if (cursor.ok && iter != latest.end() && iter->second.first < offset)
+            {
+                iter->second = std::make_pair(offset, pose);
+            }
+        }
+    }
+
+    std::map<double, SE3d> poses;
+    for (auto &pair : latest)
+    {
+        poses[pair.first] = pair.second.second;
+    }
+    return poses;
+}
+
+/**
+ * load keyframes into the map, observations of landmarks created before start are dropped
+ * @param start     time of the first keyframe
+ * @param end       time of the last keyframe, 0 means all keyframes after start
+ * @return loaded keyframes
+ */
+Frames MapReader::LoadKeyFrames(double start, double end)
+{
+    std::map<double, SE3d> poses = GetPoses();
+    auto start_iter = index_.lower_bound(start);
+    auto end_iter = end == 0 ? index_.end() : index_.upper_bound(end);
+    Frames kfs;
+    for (auto iter = start_iter; iter != end_iter; iter++)
+    {
+        double time = iter->first;
+        if (!poses.count(time))
+            continue;
+        Frame::Ptr frame = Frame::Create();
+        frame->time = time;
+        frame->pose = poses[time];
+        Map::Instance().InsertKeyFrame(frame);
+        kfs[time] = frame;
+
+        uint32_t size;
+        const char *payload = Payload(time, map_file::Landmarks, size);
+        if (payload)
+        {
+            Cursor cursor(payload, size);
+            uint32_t n = cursor.Get<uint32_t>();
+            for (uint32_t i = 0; i < n && cursor.ok; i++)
+            {
+                uint64_t id = cursor.Get<uint64_t>();
+                Vector3d position;
+                position.x() = cursor.Get<double>();
+                position.y() = cursor.Get<double>();
+                position.z() = cursor.Get<double>();
+                cv::Point2f kp;
+                kp.x = cursor.Get<float>();
+                kp.y = cursor.Get<float>();
+                if (!cursor.ok)
+                    break;
+                // keep the ids of the file, so the map stays consistent when new keyframes are appended
+                auto landmark = visual::Landmark::Create(position);
+                landmark->id = id;
+                visual::Landmark::current_landmark_id = std::max(visual::Landmark::current_landmark_id, (unsigned long)id);
+                auto feature = visual::Feature::Create(frame, kp, landmark);
+                feature->is_on_left_image = false;
+                landmark->first_observation = feature;
+                frame->AddFeature(feature);
+                Map::Instance().InsertLandmark(landmark);
+                landmarks_[id] = landmark;
+            }
+        }
+
+        payload = Payload(time, map_file::Features, size);
+        if (payload)
+        {
+            Cursor cursor(payload, size);
+            uint32_t n = cursor.Get<uint32_t>();
+            for (uint32_t i = 0; i < n && cursor.ok; i++)
+            {
+                uint64_t id = cursor.Get<uint64_t>();
+                cv::Point2f kp;
+                kp.x = cursor.Get<float>();
+                kp.y = cursor.Get<float>();
+                auto landmark_iter = landmarks_.find(id);
+                if (!cursor.ok || landmark_iter == landmarks_.end())
+                    continue;
+                auto feature = visual::Feature::Create(frame, kp, landmark_iter->second);
+                frame->AddFeature(feature);
+                landmark_iter->second->AddObservation(feature);
+            }
+        }
+
+        payload = Payload(time, map_file::Descriptors, size);
+        if (payload)
+        {
+            Cursor cursor(payload, size);
+            uint32_t n = cursor.Get<uint32_t>();
+            for (uint32_t i = 0; i < n && cursor.ok; i++)
+            {
+                uint64_t id = cursor.Get<uint64_t>();
+                const char *p = cursor.Skip(32);
+                auto landmark_iter = landmarks_.find(id);
+                if (!cursor.ok || landmark_iter == landmarks_.end())
+                    continue;
+                frame->descriptors[landmark_iter->second->id] = cv::Mat(1, 32, CV_8U, const_cast<char *>(p)).clone();
+            }
+        }
+
+        payload = Payload(time, map_file::Lidar, size);
+        if (payload)
+        {
+            Cursor cursor(payload, size);
+            uint32_t num_surf = cursor.Get<uint32_t>();
+            uint32_t num_ground = cursor.Get<uint32_t>();
+            frame->feature_lidar = lidar::Feature::Create();
+            for (uint32_t i = 0; i < num_surf + num_ground && cursor.ok; i++)
+            {
+                PointI point;
+                point.x = cursor.Get<float>();
+                point.y = cursor.Get<float>();
+                point.z = cursor.Get<float>();
+                point.intensity = cursor.Get<float>();
+                if (!cursor.ok)
+                    break;
+                (i < num_surf ? frame->feature_lidar->points_surf : frame->feature_lidar->points_ground).push_back(point);
+            }
+        }
+    }
+    LOG(INFO) << "Load " << kfs.size() << " keyframes from the map file.";
+    return kfs;
+}
+
+} // namespace lvio_fusion
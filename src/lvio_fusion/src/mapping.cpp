@@ -5,35 +5,13 @@
 #include "lvio_fusion/map.h"
 #include "lvio_fusion/utility.h"
 
-#include <pcl/filters/voxel_grid.h>
-
 namespace lvio_fusion
 {
 
-inline void Mapping::Color(const PointICloud &points_ground, const PointICloud &points_surf, Frame::Ptr frame, PointRGBCloud &out)
+Mapping::Mapping(double tile_size, int num_tiles, const std::string &tiles_path)
+    : tiles_(new MapTiles(tile_size, num_tiles, tiles_path)),
+      voxel_map_(new VoxelMap(Lidar::Get()->resolution * 2, 16))
 {
-    for (int i = 0; i < points_ground.size(); i++)
-    {
-        PointRGB point_color;
-        point_color.x = points_ground[i].x;
-        point_color.y = points_ground[i].y;
-        point_color.z = points_ground[i].z;
-        point_color.r = 255;
-        point_color.g = 0;
-        point_color.b = 255;
-        out.push_back(point_color);
-    }
-    for (int i = 0; i < points_surf.size(); i++)
-    {
-        PointRGB point_color;
-        point_color.x = points_surf[i].x;
-        point_color.y = points_surf[i].y;
-        point_color.z = points_surf[i].z;
-        point_color.r = 0;
-        point_color.g = 255;
-        point_color.b = 0;
-        out.push_back(point_color);
-    }
 }
 
 void Mapping::BuildOldMapFrame(Frames old_frames, Frame::Ptr map_frame)
@@ -42,8 +20,10 @@ void Mapping::BuildOldMapFrame(Frames old_frames, Frame::Ptr map_frame)
     PointICloud points_ground_merged;
     for (auto pair_kf : old_frames)
     {
-        points_surf_merged += pointclouds_surf[pair_kf.first];
-        points_ground_merged += pointclouds_ground[pair_kf.first];
+        PointICloud points_surf, points_ground;
+        ToWorld(pair_kf.second, points_surf, points_ground);
+        points_surf_merged += points_surf;
+        points_ground_merged += points_ground;
     }
 
     association_->SegmentGround(points_ground_merged);
@@ -67,8 +47,10 @@ void Mapping::BuildMapFrame(Frame::Ptr frame, Frame::Ptr map_frame)
     PointICloud points_ground_merged;
     for (auto pair_kf : last_frames)
     {
-        points_surf_merged += pointclouds_surf[pair_kf.first];
-        points_ground_merged += pointclouds_ground[pair_kf.first];
+        PointICloud points_surf, points_ground;
+        ToWorld(pair_kf.second, points_surf, points_ground);
+        points_surf_merged += points_surf;
+        points_ground_merged += points_ground;
     }
 
     association_->SegmentGround(points_ground_merged);
@@ -122,7 +104,6 @@ void Mapping::Optimize(Frames &active_kfs)
                 LOG(INFO) << summary.BriefReport();
             }
         }
-        ToWorld(pair_kf.second);
 
         auto t2 = std::chrono::steady_clock::now();
         auto time_used = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1);
@@ -136,47 +117,145 @@ void Mapping::MergeScan(const PointICloud &in, SE3d Twc, PointICloud &out)
     float *tf = tf_se3.data();
     for (auto point_in : in)
     {
-        PointI point_out;
+        PointI point_out = point_in;
         ceres::SE3TransformPoint(tf, point_in.data, point_out.data);
-        point_out.intensity = point_in.intensity;
         out.push_back(point_out);
     }
 }
 
-void Mapping::ToWorld(Frame::Ptr frame)
+inline bool same_pose(const SE3d &a, const SE3d &b)
 {
-    PointICloud pointcloud_surf;
-    PointICloud pointcloud_ground;
-    PointRGBCloud pointcloud_color;
-    if (frame->feature_lidar)
+    return std::equal(a.data(), a.data() + SE3d::num_parameters, b.data());
+}
+
+/**
+ * world pointclouds of the frame, cached with the pose they are transformed by,
+ * so the cache is rebuilt only when it is accessed after the pose is corrected
+ * @param frame
+ * @param points_surf       output
+ * @param points_ground     output
+ */
+void Mapping::ToWorld(Frame::Ptr frame, PointICloud &points_surf, PointICloud &points_ground)
+{
+    SE3d pose = frame->pose;
+    lidar::Feature::Ptr feature;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        SE3d cached_pose;
+        if (tiles_->Get(frame->time, cached_pose, points_surf, points_ground) && same_pose(cached_pose, pose))
+            return;
+        feature = frame->feature_lidar ? frame->feature_lidar : tiles_->GetFeature(frame->time);
+    }
+
+    points_surf.clear();
+    points_ground.clear();
+    if (feature)
     {
-        MergeScan(frame->feature_lidar->points_surf, frame->pose, pointcloud_surf);
-        MergeScan(frame->feature_lidar->points_ground, frame->pose, pointcloud_ground);
-        Color(pointcloud_ground, pointcloud_surf, frame, pointcloud_color);
+        MergeScan(feature->points_surf, pose, points_surf);
+        MergeScan(feature->points_ground, pose, points_ground);
     }
-    pointclouds_surf[frame->time] = pointcloud_surf;
-    pointclouds_ground[frame->time] = pointcloud_ground;
-    pointclouds_color[frame->time] = pointcloud_color;
+    std::unique_lock<std::mutex> lock(mutex_);
+    tiles_->Insert(frame->time, pose, points_surf, points_ground);
 }
 
-PointRGBCloud Mapping::GetGlobalMap()
+// lidar features of the frame, the ones of finalized keyframes are paged in from the tiles
+lidar::Feature::Ptr Mapping::GetFeature(Frame::Ptr frame)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return frame->feature_lidar ? frame->feature_lidar : tiles_->GetFeature(frame->time);
+}
+
+/**
+ * add finalized keyframes to the global map, their lidar features are moved into the tiles
+ * @param kfs   keyframes, the ones already in the global map are replaced if their poses are changed
+ */
+void Mapping::AddToGlobalMap(const Frames &kfs)
+{
+    for (auto pair_kf : kfs)
+    {
+        auto frame = pair_kf.second;
+        SE3d pose = frame->pose, old_pose;
+        lidar::Feature::Ptr feature = GetFeature(frame);
+        if (!feature)
+            continue;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (voxel_map_->Contains(frame->time, old_pose) && same_pose(old_pose, pose))
+                continue;
+        }
+        PointICloud points_surf, points_ground;
+        MergeScan(feature->points_surf, pose, points_surf);
+        MergeScan(feature->points_ground, pose, points_ground);
+        std::unique_lock<std::mutex> lock(mutex_);
+        voxel_map_->Insert(frame->time, pose, points_surf, points_ground);
+        tiles_->InsertFeature(frame->time, pose, feature);
+        frame->feature_lidar = nullptr;
+    }
+}
+
+// replace the corrected keyframes which are already in the global map
+void Mapping::UpdateGlobalMap(const Frames &kfs)
 {
-    PointRGBCloud global_map;
-    for (auto pair_pc : pointclouds_color)
+    Frames corrected_kfs;
     {
-        auto &pointcloud = pair_pc.second;
-        global_map.insert(global_map.end(), pointcloud.begin(), pointcloud.end());
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto pair_kf : kfs)
+        {
+            SE3d old_pose;
+            if (voxel_map_->Contains(pair_kf.first, old_pose) && !same_pose(old_pose, pair_kf.second->pose))
+            {
+                corrected_kfs.insert(pair_kf);
+            }
+        }
     }
-    if (global_map.size() > 0)
+    AddToGlobalMap(corrected_kfs);
+}
+
+PointRGBCloud Mapping::GetGlobalMap()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return voxel_map_->GetAll();
+}
+
+std::map<int, PointRGBCloud> Mapping::GetGlobalMapChanges()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return voxel_map_->GetChanges();
+}
+
+/**
+ * rebuild the transient layer of the keyframes which are not in the global map yet,
+ * it is small, so it is rebuilt after every optimization of the backend
+ * @param active_kfs    keyframes after the head of the backend
+ */
+void Mapping::UpdateActiveMap(const Frames &active_kfs)
+{
+    VoxelMap active_map(Lidar::Get()->resolution * 2, 16);
+    for (auto pair_kf : active_kfs)
     {
-        PointRGBCloud::Ptr temp(new PointRGBCloud());
-        pcl::VoxelGrid<PointRGB> voxel_filter;
-        pcl::copyPointCloud(global_map, *temp);
-        voxel_filter.setInputCloud(temp);
-        voxel_filter.setLeafSize(Lidar::Get()->resolution * 2, Lidar::Get()->resolution * 2, Lidar::Get()->resolution * 2);
-        voxel_filter.filter(global_map);
+        auto frame = pair_kf.second;
+        if (!frame->feature_lidar)
+            continue;
+        PointICloud points_surf, points_ground;
+        MergeScan(frame->feature_lidar->points_surf, frame->pose, points_surf);
+        MergeScan(frame->feature_lidar->points_ground, frame->pose, points_ground);
+        active_map.Insert(frame->time, frame->pose, points_surf, points_ground);
     }
-    return global_map;
+    PointRGBCloud active_points = active_map.GetAll();
+    std::unique_lock<std::mutex> lock(mutex_);
+    active_points_.swap(active_points);
+    active_changed_ = true;
+}
+
+// the transient layer, return false if it is not changed since the last call
+bool Mapping::GetActiveMapChange(PointRGBCloud &points)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!active_changed_)
+        return false;
+    points = active_points_;
+    active_changed_ = false;
+    return true;
 }
 
 } // namespace lvio_fusion
@@ -77,6 +77,11 @@ void Navsat::Initialize()
     initialized = true;
 }
 
+/**
+ * correct sections before time by navsat points
+ * @param time  time of the last active keyframe
+ * @return time of the first corrected keyframe, 0 if no keyframe is corrected
+ */
 double Navsat::Optimize(double time)
 {
     static double head = 0;
@@ -86,6 +91,7 @@ double Navsat::Optimize(double time)
         return 0;
 
     SE3d transform;
+    bool corrected = false;
     for (auto pair : sections)
     {
         Frames active_kfs = Map::Instance().GetKeyFrames(pair.second.A, time);
@@ -136,7 +142,10 @@ double Navsat::Optimize(double time)
         pose_graph_->ForwardPropagate(transform, Map::Instance().GetKeyFrames(pair.second.A + epsilon, pair.second.C));
 
         head = pair.second.C + epsilon;
+        corrected = true;
     }
+    if (!corrected)
+        return 0;
 
     // forward propagate
     pose_graph_->ForwardPropagate(transform, head);
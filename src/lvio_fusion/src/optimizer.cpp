@@ -24,25 +24,29 @@ void PoseGraph::AddSubMap(double old_time, double start_time, double end_time)
  */
 std::map<double, SE3d> PoseGraph::GetActiveSubMaps(Frames &active_kfs, double &old_time, double start_time)
 {
-
     auto start_iter = atlas_.lower_bound(old_time);
     auto end_iter = atlas_.upper_bound(start_time);
-    if (start_iter != atlas_.end())
+    for (auto iter = start_iter; iter != end_iter; iter++)
     {
-        for (auto iter = start_iter; iter != end_iter; iter++)
+        auto end_kf_iter = active_kfs.find(iter->first);
+        if (end_kf_iter == active_kfs.end())
+            continue;
+        if (iter->second.A <= old_time)
         {
-            if (iter->second.A <= old_time)
-            {
-                // remove outer submap
-                auto new_old_iter = ++active_kfs.find(iter->first);
-                old_time = new_old_iter->first;
-                active_kfs.erase(active_kfs.begin(), new_old_iter);
-            }
-            else
-            {
-                // remove inner submap
-                active_kfs.erase(++active_kfs.find(iter->second.A), ++active_kfs.find(iter->first));
-            }
+            // remove outer submap
+            auto new_old_iter = ++end_kf_iter;
+            if (new_old_iter == active_kfs.end())
+                break;
+            old_time = new_old_iter->first;
+            active_kfs.erase(active_kfs.begin(), new_old_iter);
+        }
+        else
+        {
+            // remove inner submap
+            auto first_kf_iter = active_kfs.find(iter->second.A);
+            if (first_kf_iter == active_kfs.end())
+                continue;
+            active_kfs.erase(++first_kf_iter, ++end_kf_iter);
         }
     }
 
@@ -125,9 +129,7 @@ void PoseGraph::BuildProblem(Atlas &sections, adapt::Problem &problem)
     for (auto &pair : sections)
     {
         Frames active_kfs = Map::Instance().GetKeyFrames(pair.second.A, pair.second.B);
-        ceres::LocalParameterization *local_parameterization = new ceres::ProductParameterization(
-            new ceres::EigenQuaternionParameterization(),
-            new ceres::IdentityParameterization(3));
+        ceres::LocalParameterization *local_parameterization = new SE3Parameterization();
 
         Frame::Ptr last_frame;
         for (auto pair_kf : active_kfs)
@@ -153,14 +155,117 @@ void PoseGraph::BuildProblem(Atlas &sections, adapt::Problem &problem)
     }
 }
 
+void PoseGraph::BuildProblem(Frames &active_kfs, adapt::Problem &problem)
+{
+    ceres::LocalParameterization *local_parameterization = new SE3Parameterization();
+
+    Frame::Ptr last_frame;
+    for (auto pair_kf : active_kfs)
+    {
+        auto frame = pair_kf.second;
+        double *para_kf = frame->pose.data();
+        problem.AddParameterBlock(para_kf, SE3d::num_parameters, local_parameterization);
+        if (last_frame)
+        {
+            double *para_last_kf = last_frame->pose.data();
+            ceres::CostFunction *cost_function;
+            cost_function = PoseGraphError::Create(last_frame->pose, frame->pose, frame->weights.pose_graph);
+            problem.AddResidualBlock(ProblemType::Other, cost_function, NULL, para_last_kf, para_kf);
+        }
+        else
+        {
+            // the first frame is the anchor of the pose graph
+            problem.SetParameterBlockConstant(para_kf);
+        }
+        last_frame = frame;
+    }
+}
+
+inline void solve_pose_graph(adapt::Problem &problem)
+{
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    options.max_solver_time_in_seconds = 1;
+    options.num_threads = std::max(1u, std::thread::hardware_concurrency());
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+    LOG(INFO) << summary.BriefReport();
+}
+
 void PoseGraph::Optimize(Atlas &sections, adapt::Problem &problem)
 {
-    // ceres::Solver::Options options;
-    // options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
-    // options.num_threads = 1;
-    // ceres::Solver::Summary summary;
-    // ceres::Solve(options, &problem, &summary);
-    // LOG(INFO) << summary.FullReport();
+    solve_pose_graph(problem);
+}
+
+/**
+ * optimize the active pose graph, and then move inner submaps rigidly with their first frames
+ * @param all_kfs           all frames of active submaps and inner submaps
+ * @param active_kfs        frames in the pose graph
+ * @param problem           pose graph problem built from active_kfs
+ * @param inner_old_frames  result of GetActiveSubMaps
+ */
+void PoseGraph::Optimize(Frames &all_kfs, Frames &active_kfs, adapt::Problem &problem, std::map<double, SE3d> &inner_old_frames)
+{
+    solve_pose_graph(problem);
+
+    // update pose of inner submaps
+    for (auto pair_of : inner_old_frames)
+    {
+        auto old_frame = active_kfs[pair_of.first];
+        // T2_new = T1_new * T1.inverse() * T2
+        SE3d transform = old_frame->pose * pair_of.second.inverse();
+        Frames inner_kfs;
+        for (auto iter = ++all_kfs.find(pair_of.first); iter != all_kfs.end() && active_kfs.find(iter->first) == active_kfs.end(); iter++)
+        {
+            inner_kfs.insert(*iter);
+        }
+        ForwardPropagate(transform, inner_kfs);
+    }
+}
+
+void PoseGraph::Publish(loop::Correction::Ptr correction)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    correction->version = ++version_;
+    corrections_.push(correction);
+}
+
+/**
+ * apply published corrections on top of the current poses, called by the backend once a correction is published
+ * @return corrected keyframes
+ */
+Frames PoseGraph::ApplyCorrections()
+{
+    std::queue<loop::Correction::Ptr> corrections;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        corrections.swap(corrections_);
+    }
+
+    Frames corrected_kfs;
+    while (!corrections.empty())
+    {
+        auto correction = corrections.front();
+        corrections.pop();
+        if (correction->deltas.empty())
+            continue;
+
+        Frames kfs = Map::Instance().GetKeyFrames(correction->deltas.begin()->first, correction->end_time);
+        for (auto pair_kf : kfs)
+        {
+            auto iter = correction->deltas.find(pair_kf.first);
+            if (iter != correction->deltas.end())
+            {
+                pair_kf.second->pose = iter->second * pair_kf.second->pose;
+                corrected_kfs.insert(pair_kf);
+            }
+        }
+        ForwardPropagate(correction->transform, correction->end_time + epsilon);
+        Frames forward_kfs = Map::Instance().GetKeyFrames(correction->end_time + epsilon);
+        corrected_kfs.insert(forward_kfs.begin(), forward_kfs.end());
+        LOG(INFO) << "Apply loop correction, version:" << correction->version;
+    }
+    return corrected_kfs;
 }
 
 // end_time = 0 means full forward propagate
@@ -0,0 +1,155 @@
+#include "lvio_fusion/lidar/parser.h"
+
+namespace lvio_fusion
+{
+
+namespace lidar
+{
+
+// a strided pass over one field, the type is resolved once for all points
+template <typename T, typename Setter>
+inline void read_field(const uint8_t *data, size_t num_points, uint32_t step, const Field &field, PointI *point, Setter set)
+{
+    const uint8_t *p = data + field.offset;
+    for (size_t i = 0; i < num_points; i++, p += step)
+    {
+        T value;
+        memcpy(&value, p, sizeof(T));
+        set(point[i], value * field.scale);
+    }
+}
+
+template <typename Setter>
+inline void parse_field(const uint8_t *data, size_t num_points, uint32_t step, const Field &field, PointI *point, Setter set)
+{
+    switch (field.type)
+    {
+    case FieldType::Int8:
+        read_field<int8_t>(data, num_points, step, field, point, set);
+        break;
+    case FieldType::UInt8:
+        read_field<uint8_t>(data, num_points, step, field, point, set);
+        break;
+    case FieldType::Int16:
+        read_field<int16_t>(data, num_points, step, field, point, set);
+        break;
+    case FieldType::UInt16:
+        read_field<uint16_t>(data, num_points, step, field, point, set);
+        break;
+    case FieldType::Int32:
+        read_field<int32_t>(data, num_points, step, field, point, set);
+        break;
+    case FieldType::UInt32:
+        read_field<uint32_t>(data, num_points, step, field, point, set);
+        break;
+    case FieldType::Float32:
+        read_field<float>(data, num_points, step, field, point, set);
+        break;
+    case FieldType::Float64:
+        read_field<double>(data, num_points, step, field, point, set);
+        break;
+    default:
+        for (size_t i = 0; i < num_points; i++)
+        {
+            set(point[i], 0);
+        }
+        break;
+    }
+}
+
+inline uint32_t field_size(FieldType type)
+{
+    switch (type)
+    {
+    case FieldType::Int8:
+    case FieldType::UInt8:
+        return 1;
+    case FieldType::Int16:
+    case FieldType::UInt16:
+        return 2;
+    case FieldType::Int32:
+    case FieldType::UInt32:
+    case FieldType::Float32:
+        return 4;
+    case FieldType::Float64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// an absent field is valid, a present one must be a known type inside a point
+inline bool is_valid_field(const Field &field, uint32_t point_step)
+{
+    uint32_t size = field_size(field.type);
+    return field.type == FieldType::None || (size > 0 && (uint64_t)field.offset + size <= point_step);
+}
+
+inline bool is_packed_xyz(const FieldLayout &layout)
+{
+    return layout.x.type == FieldType::Float32 && layout.y.type == FieldType::Float32 && layout.z.type == FieldType::Float32 &&
+           layout.y.offset == layout.x.offset + 4 && layout.z.offset == layout.x.offset + 8 &&
+           layout.x.scale == 1 && layout.y.scale == 1 && layout.z.scale == 1;
+}
+
+inline void parse_row(const uint8_t *data, size_t num_points, const FieldLayout &layout, PointI *point)
+{
+    const uint32_t step = layout.point_step;
+    if (is_packed_xyz(layout))
+    {
+        // the common layout of drivers, copy xyz as a whole
+        const uint8_t *p = data + layout.x.offset;
+        for (size_t i = 0; i < num_points; i++, p += step)
+        {
+            memcpy(point[i].data, p, 3 * sizeof(float));
+            point[i].data[3] = 1;
+        }
+    }
+    else
+    {
+        parse_field(data, num_points, step, layout.x, point, [](PointI &point, double value) { point.x = value; point.data[3] = 1; });
+        parse_field(data, num_points, step, layout.y, point, [](PointI &point, double value) { point.y = value; });
+        parse_field(data, num_points, step, layout.z, point, [](PointI &point, double value) { point.z = value; });
+    }
+    parse_field(data, num_points, step, layout.intensity, point, [](PointI &point, double value) { point.intensity = value; });
+    parse_field(data, num_points, step, layout.ring, point, [](PointI &point, double value) { point.ring = value; });
+    parse_field(data, num_points, step, layout.time, point, [](PointI &point, double value) { point.time = value; });
+}
+
+/**
+ * parse points from a raw buffer into the point type of the library in one pass per field and row
+ * @param data          raw buffer of points
+ * @param size          size of the buffer in bytes
+ * @param width         number of points in a row
+ * @param height        number of rows
+ * @param layout        offsets and types of fields
+ * @param out           output, absent fields are set to 0
+ * @return false if the layout doesn't match the buffer or x, y, z are absent, out is not changed
+ */
+bool ParsePoints(const uint8_t *data, size_t size, uint32_t width, uint32_t height, const FieldLayout &layout, PointICloud &out)
+{
+    if (layout.x.type == FieldType::None || layout.y.type == FieldType::None || layout.z.type == FieldType::None)
+        return false;
+    for (auto field : {&layout.x, &layout.y, &layout.z, &layout.intensity, &layout.ring, &layout.time})
+    {
+        if (!is_valid_field(*field, layout.point_step))
+            return false;
+    }
+    if (height > 0 && ((uint64_t)width * layout.point_step > layout.row_step || (uint64_t)height * layout.row_step > size))
+        return false;
+
+    size_t num_points = (size_t)width * height;
+    out.points.resize(num_points);
+    out.width = num_points;
+    out.height = 1;
+    out.is_dense = false;
+    for (uint32_t row = 0; row < height; row++)
+    {
+        parse_row(data + (size_t)row * layout.row_step, width, layout, out.points.data() + (size_t)row * width);
+    }
+    return true;
+}
+
+} // namespace lidar
+
+} // namespace lvio_fusion
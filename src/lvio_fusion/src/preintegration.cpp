@@ -8,23 +8,71 @@ namespace lvio_fusion
 namespace imu
 {
 //NOTE:translation,rotation,velocity,ba,bg,para_pose(rotation,translation)
-int O_T = 0, O_R = 3, O_V = 6, O_BA = 9, O_BG = 12, O_PR = 0, O_PT = 4;
+int O_T = 0, O_R = 3, O_V = 6, O_BA = 9, O_BG = 12;
 Vector3d g(0, 0, 9.8);
 
-Preintegration::Preintegration(const Vector3d &_acc_0, const Vector3d &_gyr_0, const Vector3d &_v0,
-                               const Vector3d &_linearized_ba, const Vector3d &_linearized_bg)
-    : acc0{_acc_0}, gyr0{_gyr_0}, v0(_v0), linearized_acc{_acc_0}, linearized_gyr{_gyr_0},
-      linearized_ba{_linearized_ba}, linearized_bg{_linearized_bg},
-      jacobian{Matrix<double, 15, 15>::Identity()}, covariance{Matrix<double, 15, 15>::Zero()},
-      sum_dt{0.0}, delta_p{Vector3d::Zero()}, delta_q{Quaterniond::Identity()}, delta_v{Vector3d::Zero()}
+// preintegrations are recycled, so that their sample buffers are allocated only once
+static const size_t max_num_samples = 1000;
+static const size_t max_num_recycled = 64;
+// bias changes beyond these thresholds are not corrected by first order approximation
+static const double max_ba_change = 0.1;
+static const double max_bg_change = 0.01;
+static std::mutex pool_mutex;
+static std::vector<Preintegration *> *pool = new std::vector<Preintegration *>();
+
+Preintegration::Ptr Preintegration::Create(const Vector3d &_acc_0, const Vector3d &_gyr_0, const Vector3d &_v0, const Vector3d &_linearized_ba, const Vector3d &_linearized_bg)
+{
+    Preintegration *new_preintegration = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        if (!pool->empty())
+        {
+            new_preintegration = pool->back();
+            pool->pop_back();
+        }
+    }
+    if (!new_preintegration)
+    {
+        new_preintegration = new Preintegration();
+        new_preintegration->buf.reserve(max_num_samples);
+    }
+    new_preintegration->Reset(_acc_0, _gyr_0, _v0, _linearized_ba, _linearized_bg);
+    return Preintegration::Ptr(new_preintegration, Preintegration::Recycle);
+}
+
+void Preintegration::Recycle(Preintegration *preintegration)
+{
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    if (pool->size() < max_num_recycled)
+    {
+        pool->push_back(preintegration);
+    }
+    else
+    {
+        lock.unlock();
+        delete preintegration;
+    }
+}
+
+void Preintegration::Reset(const Vector3d &_acc_0, const Vector3d &_gyr_0, const Vector3d &_v0,
+                           const Vector3d &_linearized_ba, const Vector3d &_linearized_bg)
 {
-    noise = Matrix<double, 18, 18>::Zero();
-    noise.block<3, 3>(0, 0) = (Imu::Get()->ACC_N * Imu::Get()->ACC_N) * Matrix3d::Identity();
-    noise.block<3, 3>(3, 3) = (Imu::Get()->GYR_N * Imu::Get()->GYR_N) * Matrix3d::Identity();
-    noise.block<3, 3>(6, 6) = (Imu::Get()->ACC_N * Imu::Get()->ACC_N) * Matrix3d::Identity();
-    noise.block<3, 3>(9, 9) = (Imu::Get()->GYR_N * Imu::Get()->GYR_N) * Matrix3d::Identity();
-    noise.block<3, 3>(12, 12) = (Imu::Get()->ACC_W * Imu::Get()->ACC_W) * Matrix3d::Identity();
-    noise.block<3, 3>(15, 15) = (Imu::Get()->GYR_W * Imu::Get()->GYR_W) * Matrix3d::Identity();
+    acc0 = linearized_acc = _acc_0;
+    gyr0 = linearized_gyr = _gyr_0;
+    v0 = _v0;
+    linearized_ba = _linearized_ba;
+    linearized_bg = _linearized_bg;
+    ba = _linearized_ba;
+    bg = _linearized_bg;
+    jacobian.setIdentity();
+    covariance.setZero();
+    sum_dt = 0.0;
+    delta_p.setZero();
+    delta_q.setIdentity();
+    delta_v.setZero();
+    repropagated_ba_ = _linearized_ba;
+    repropagated_bg_ = _linearized_bg;
+    buf.clear();
 }
 
 void Preintegration::Repropagate(const Vector3d &_linearized_ba, const Vector3d &_linearized_bg)
@@ -35,14 +83,120 @@ void Preintegration::Repropagate(const Vector3d &_linearized_ba, const Vector3d
     delta_p.setZero();
     delta_q.setIdentity();
     delta_v.setZero();
-    linearized_ba = _linearized_ba;
-    linearized_bg = _linearized_bg;
+    linearized_ba = repropagated_ba_ = _linearized_ba;
+    linearized_bg = repropagated_bg_ = _linearized_bg;
     jacobian.setIdentity();
     covariance.setZero();
-    for (int i = 0; i < static_cast<int>(dt_buf.size()); i++)
-        Propagate(dt_buf[i], acc_buf[i], gyr_buf[i]);
+    for (auto &sample : buf)
+        Propagate(sample.dt, sample.acc, sample.gyr);
 }
 
+/**
+ * append the following preintegration without integrating its samples again
+ * @param next      preintegration starts at the end of this one
+ */
+void Preintegration::Merge(Preintegration::Ptr next)
+{
+    if (next->linearized_ba != linearized_ba || next->linearized_bg != linearized_bg)
+    {
+        next->Correct(linearized_ba, linearized_bg);
+    }
+
+    // the transition of next is rotated by delta_q, T * Phi * T^-1
+    Matrix3d R = delta_q.toRotationMatrix();
+    Matrix<double, 15, 15> T = Matrix<double, 15, 15>::Identity();
+    T.block<3, 3>(O_T, O_T) = R;
+    T.block<3, 3>(O_V, O_V) = R;
+    Matrix<double, 15, 15> phi = T * next->jacobian * T.transpose();
+    jacobian = phi * jacobian;
+    covariance = phi * covariance * phi.transpose() + T * next->covariance * T.transpose();
+
+    delta_p += delta_v * next->sum_dt + R * next->delta_p;
+    delta_v += R * next->delta_v;
+    delta_q = (delta_q * next->delta_q).normalized();
+    sum_dt += next->sum_dt;
+    dt = next->dt;
+    acc0 = next->acc0;
+    gyr0 = next->gyr0;
+    acc1 = next->acc1;
+    gyr1 = next->gyr1;
+    buf.insert(buf.end(), next->buf.begin(), next->buf.end());
+}
+
+/**
+ * update biases, small changes are corrected by first order approximation in O(1),
+ * large changes are repropagated.
+ * @param _linearized_ba    new bias of accelerometer
+ * @param _linearized_bg    new bias of gyroscope
+ */
+void Preintegration::Correct(const Vector3d &_linearized_ba, const Vector3d &_linearized_bg)
+{
+    if ((_linearized_ba - repropagated_ba_).norm() > max_ba_change ||
+        (_linearized_bg - repropagated_bg_).norm() > max_bg_change)
+    {
+        Repropagate(_linearized_ba, _linearized_bg);
+        return;
+    }
+
+    Vector3d dba = _linearized_ba - linearized_ba;
+    Vector3d dbg = _linearized_bg - linearized_bg;
+    delta_p += dp_dba() * dba + dp_dbg() * dbg;
+    delta_q = (delta_q * q_delta(dq_dbg() * dbg)).normalized();
+    delta_v += dv_dba() * dba + dv_dbg() * dbg;
+    linearized_ba = _linearized_ba;
+    linearized_bg = _linearized_bg;
+}
+
+#ifdef CHECK_EQUIVALENCE
+/**
+ * dense reference of the block-wise propagation in MidPointIntegration, only used to check it if CHECK_EQUIVALENCE is defined
+ * M = F * M, P = F * P * F^T + V * noise * V^T
+ */
+static void dense_propagation(double _dt, const Matrix3d &R_0, const Matrix3d &R_1,
+                              const Matrix3d &R_w_x, const Matrix3d &R_a_0_x, const Matrix3d &R_a_1_x,
+                              Matrix<double, 15, 15> &jacobian, Matrix<double, 15, 15> &covariance)
+{
+    Matrix<double, 15, 15> F = Matrix<double, 15, 15>::Zero();
+    F.block<3, 3>(0, 0) = Matrix3d::Identity();
+    F.block<3, 3>(0, 3) = -0.25 * R_0 * R_a_0_x * _dt * _dt +
+                          -0.25 * R_1 * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt * _dt;
+    F.block<3, 3>(0, 6) = Matrix3d::Identity() * _dt;
+    F.block<3, 3>(0, 9) = -0.25 * (R_0 + R_1) * _dt * _dt;
+    F.block<3, 3>(0, 12) = -0.25 * R_1 * R_a_1_x * _dt * _dt * -_dt;
+    F.block<3, 3>(3, 3) = Matrix3d::Identity() - R_w_x * _dt;
+    F.block<3, 3>(3, 12) = -1.0 * Matrix3d::Identity() * _dt;
+    F.block<3, 3>(6, 3) = -0.5 * R_0 * R_a_0_x * _dt +
+                          -0.5 * R_1 * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt;
+    F.block<3, 3>(6, 6) = Matrix3d::Identity();
+    F.block<3, 3>(6, 9) = -0.5 * (R_0 + R_1) * _dt;
+    F.block<3, 3>(6, 12) = -0.5 * R_1 * R_a_1_x * _dt * -_dt;
+    F.block<3, 3>(9, 9) = Matrix3d::Identity();
+    F.block<3, 3>(12, 12) = Matrix3d::Identity();
+
+    Matrix<double, 15, 18> V = Matrix<double, 15, 18>::Zero();
+    V.block<3, 3>(0, 0) = 0.25 * R_0 * _dt * _dt;
+    V.block<3, 3>(0, 3) = 0.25 * -R_1 * R_a_1_x * _dt * _dt * 0.5 * _dt;
+    V.block<3, 3>(0, 6) = 0.25 * R_1 * _dt * _dt;
+    V.block<3, 3>(0, 9) = V.block<3, 3>(0, 3);
+    V.block<3, 3>(3, 3) = 0.5 * Matrix3d::Identity() * _dt;
+    V.block<3, 3>(3, 9) = 0.5 * Matrix3d::Identity() * _dt;
+    V.block<3, 3>(6, 0) = 0.5 * R_0 * _dt;
+    V.block<3, 3>(6, 3) = 0.5 * -R_1 * R_a_1_x * _dt * 0.5 * _dt;
+    V.block<3, 3>(6, 6) = 0.5 * R_1 * _dt;
+    V.block<3, 3>(6, 9) = V.block<3, 3>(6, 3);
+    V.block<3, 3>(9, 12) = Matrix3d::Identity() * _dt;
+    V.block<3, 3>(12, 15) = Matrix3d::Identity() * _dt;
+
+    jacobian = F * jacobian;
+    covariance = F * covariance * F.transpose() + V * Imu::Get()->noise * V.transpose();
+}
+
+inline bool is_close(const Matrix<double, 15, 15> &a, const Matrix<double, 15, 15> &b)
+{
+    return (a - b).norm() <= 1e-9 * b.norm();
+}
+#endif
+
 void Preintegration::MidPointIntegration(double _dt,
                                          const Vector3d &_acc_0, const Vector3d &_gyr_0,
                                          const Vector3d &_acc_1, const Vector3d &_gyr_1,
@@ -66,51 +220,70 @@ void Preintegration::MidPointIntegration(double _dt,
         Vector3d w_x = 0.5 * (_gyr_0 + _gyr_1) - linearized_bg;
         Vector3d a_0_x = _acc_0 - linearized_ba;
         Vector3d a_1_x = _acc_1 - linearized_ba;
-        Matrix3d R_w_x, R_a_0_x, R_a_1_x;
-
-        R_w_x << 0, -w_x(2), w_x(1),
-            w_x(2), 0, -w_x(0),
-            -w_x(1), w_x(0), 0;
-        R_a_0_x << 0, -a_0_x(2), a_0_x(1),
-            a_0_x(2), 0, -a_0_x(0),
-            -a_0_x(1), a_0_x(0), 0;
-        R_a_1_x << 0, -a_1_x(2), a_1_x(1),
-            a_1_x(2), 0, -a_1_x(0),
-            -a_1_x(1), a_1_x(0), 0;
-
-        MatrixXd F = MatrixXd::Zero(15, 15);
-        F.block<3, 3>(0, 0) = Matrix3d::Identity();
-        F.block<3, 3>(0, 3) = -0.25 * delta_q.toRotationMatrix() * R_a_0_x * _dt * _dt +
-                              -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt * _dt;
-        F.block<3, 3>(0, 6) = MatrixXd::Identity(3, 3) * _dt;
-        F.block<3, 3>(0, 9) = -0.25 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt * _dt;
-        F.block<3, 3>(0, 12) = -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * _dt * -_dt;
-        F.block<3, 3>(3, 3) = Matrix3d::Identity() - R_w_x * _dt;
-        F.block<3, 3>(3, 12) = -1.0 * MatrixXd::Identity(3, 3) * _dt;
-        F.block<3, 3>(6, 3) = -0.5 * delta_q.toRotationMatrix() * R_a_0_x * _dt +
-                              -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt;
-        F.block<3, 3>(6, 6) = Matrix3d::Identity();
-        F.block<3, 3>(6, 9) = -0.5 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt;
-        F.block<3, 3>(6, 12) = -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * -_dt;
-        F.block<3, 3>(9, 9) = Matrix3d::Identity();
-        F.block<3, 3>(12, 12) = Matrix3d::Identity();
-
-        MatrixXd V = MatrixXd::Zero(15, 18);
-        V.block<3, 3>(0, 0) = 0.25 * delta_q.toRotationMatrix() * _dt * _dt;
-        V.block<3, 3>(0, 3) = 0.25 * -result_delta_q.toRotationMatrix() * R_a_1_x * _dt * _dt * 0.5 * _dt;
-        V.block<3, 3>(0, 6) = 0.25 * result_delta_q.toRotationMatrix() * _dt * _dt;
-        V.block<3, 3>(0, 9) = V.block<3, 3>(0, 3);
-        V.block<3, 3>(3, 3) = 0.5 * MatrixXd::Identity(3, 3) * _dt;
-        V.block<3, 3>(3, 9) = 0.5 * MatrixXd::Identity(3, 3) * _dt;
-        V.block<3, 3>(6, 0) = 0.5 * delta_q.toRotationMatrix() * _dt;
-        V.block<3, 3>(6, 3) = 0.5 * -result_delta_q.toRotationMatrix() * R_a_1_x * _dt * 0.5 * _dt;
-        V.block<3, 3>(6, 6) = 0.5 * result_delta_q.toRotationMatrix() * _dt;
-        V.block<3, 3>(6, 9) = V.block<3, 3>(6, 3);
-        V.block<3, 3>(9, 12) = MatrixXd::Identity(3, 3) * _dt;
-        V.block<3, 3>(12, 15) = MatrixXd::Identity(3, 3) * _dt;
-
-        jacobian = F * jacobian;
-        covariance = F * covariance * F.transpose() + V * noise * V.transpose();
+        Matrix3d R_w_x = skew_symmetric(w_x);
+        Matrix3d R_a_0_x = skew_symmetric(a_0_x);
+        Matrix3d R_a_1_x = skew_symmetric(a_1_x);
+        Matrix3d R_0 = delta_q.toRotationMatrix();
+        Matrix3d R_1 = result_delta_q.toRotationMatrix();
+        double dt2 = _dt * _dt;
+#ifdef CHECK_EQUIVALENCE
+        Matrix<double, 15, 15> expected_jacobian = jacobian, expected_covariance = covariance;
+        dense_propagation(_dt, R_0, R_1, R_w_x, R_a_0_x, R_a_1_x, expected_jacobian, expected_covariance);
+#endif
+
+        // non-trivial blocks of F, the others are identity, dt * identity or zero
+        Matrix3d R_1_a_1_x = R_1 * R_a_1_x;
+        Matrix3d F_T_R = -0.25 * R_0 * R_a_0_x * dt2 - 0.25 * R_1_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * dt2;
+        Matrix3d F_T_BA = -0.25 * (R_0 + R_1) * dt2;
+        Matrix3d F_T_BG = 0.25 * R_1_a_1_x * dt2 * _dt;
+        Matrix3d F_R_R = Matrix3d::Identity() - R_w_x * _dt;
+        Matrix3d F_V_R = -0.5 * R_0 * R_a_0_x * _dt - 0.5 * R_1_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt;
+        Matrix3d F_V_BA = -0.5 * (R_0 + R_1) * _dt;
+        Matrix3d F_V_BG = 0.5 * R_1_a_1_x * dt2;
+
+        // M = F * M, only rows of T, R, V are changed
+        auto apply_F = [&](Matrix<double, 15, 15> &M) {
+            Matrix<double, 3, 15> M_R = M.middleRows<3>(3);
+            Matrix<double, 3, 15> M_V = M.middleRows<3>(6);
+            Matrix<double, 3, 15> M_BA = M.middleRows<3>(9);
+            Matrix<double, 3, 15> M_BG = M.middleRows<3>(12);
+            M.middleRows<3>(0) += F_T_R * M_R + _dt * M_V + F_T_BA * M_BA + F_T_BG * M_BG;
+            M.middleRows<3>(3) = F_R_R * M_R - _dt * M_BG;
+            M.middleRows<3>(6) += F_V_R * M_R + F_V_BA * M_BA + F_V_BG * M_BG;
+        };
+        apply_F(jacobian);
+        apply_F(covariance);
+        covariance.transposeInPlace();
+        apply_F(covariance);
+
+        // V * noise * V^T, noise is diagonal with blocks of scalar variances
+        const Matrix<double, 18, 18> &noise = Imu::Get()->noise;
+        double acc_n = noise(0, 0), gyr_n = noise(3, 3), acc_w = noise(12, 12), gyr_w = noise(15, 15);
+        Matrix3d V_T_A0 = 0.25 * R_0 * dt2;
+        Matrix3d V_T_G = -0.125 * R_1_a_1_x * dt2 * _dt;
+        Matrix3d V_T_A1 = 0.25 * R_1 * dt2;
+        Matrix3d V_V_A0 = 0.5 * R_0 * _dt;
+        Matrix3d V_V_G = -0.25 * R_1_a_1_x * dt2;
+        Matrix3d V_V_A1 = 0.5 * R_1 * _dt;
+        Matrix3d Q_T_T = acc_n * (V_T_A0 * V_T_A0.transpose() + V_T_A1 * V_T_A1.transpose()) + 2 * gyr_n * V_T_G * V_T_G.transpose();
+        Matrix3d Q_T_R = gyr_n * _dt * V_T_G;
+        Matrix3d Q_T_V = acc_n * (V_T_A0 * V_V_A0.transpose() + V_T_A1 * V_V_A1.transpose()) + 2 * gyr_n * V_T_G * V_V_G.transpose();
+        Matrix3d Q_R_V = gyr_n * _dt * V_V_G.transpose();
+        Matrix3d Q_V_V = acc_n * (V_V_A0 * V_V_A0.transpose() + V_V_A1 * V_V_A1.transpose()) + 2 * gyr_n * V_V_G * V_V_G.transpose();
+        covariance.block<3, 3>(0, 0) += Q_T_T;
+        covariance.block<3, 3>(0, 3) += Q_T_R;
+        covariance.block<3, 3>(3, 0) += Q_T_R.transpose();
+        covariance.block<3, 3>(0, 6) += Q_T_V;
+        covariance.block<3, 3>(6, 0) += Q_T_V.transpose();
+        covariance.block<3, 3>(3, 3) += 0.5 * gyr_n * dt2 * Matrix3d::Identity();
+        covariance.block<3, 3>(3, 6) += Q_R_V;
+        covariance.block<3, 3>(6, 3) += Q_R_V.transpose();
+        covariance.block<3, 3>(6, 6) += Q_V_V;
+        covariance.block<3, 3>(9, 9) += acc_w * dt2 * Matrix3d::Identity();
+        covariance.block<3, 3>(12, 12) += gyr_w * dt2 * Matrix3d::Identity();
+#ifdef CHECK_EQUIVALENCE
+        assert(is_close(jacobian, expected_jacobian) && is_close(covariance, expected_covariance));
+#endif
     }
 }
 
@@ -145,16 +318,11 @@ Matrix<double, 15, 1> Preintegration::Evaluate(const Vector3d &Pi, const Quatern
                                                const Vector3d &Pj, const Quaterniond &Qj, const Vector3d &Vj, const Vector3d &Baj, const Vector3d &Bgj)
 {
     Matrix<double, 15, 1> residuals;
-    Matrix3d dp_dba = jacobian.block<3, 3>(O_T, O_BA);
-    Matrix3d dp_dbg = jacobian.block<3, 3>(O_T, O_BG);
-    Matrix3d dq_dbg = jacobian.block<3, 3>(O_R, O_BG);
-    Matrix3d dv_dba = jacobian.block<3, 3>(O_V, O_BA);
-    Matrix3d dv_dbg = jacobian.block<3, 3>(O_V, O_BG);
     Vector3d dba = Bai - linearized_ba;
     Vector3d dbg = Bgi - linearized_bg;
-    Quaterniond corrected_delta_q = delta_q * q_delta(dq_dbg * dbg);
-    Vector3d corrected_delta_v = delta_v + dv_dba * dba + dv_dbg * dbg;
-    Vector3d corrected_delta_p = delta_p + dp_dba * dba + dp_dbg * dbg;
+    Quaterniond corrected_delta_q = delta_q * q_delta(dq_dbg() * dbg);
+    Vector3d corrected_delta_v = delta_v + dv_dba() * dba + dv_dbg() * dbg;
+    Vector3d corrected_delta_p = delta_p + dp_dba() * dba + dp_dbg() * dbg;
     residuals.block<3, 1>(O_T, 0) = Qi.inverse() * (0.5 * g * sum_dt * sum_dt + Pj - Pi - Vi * sum_dt) - corrected_delta_p;
     residuals.block<3, 1>(O_R, 0) = 2 * (corrected_delta_q.inverse() * (Qi.inverse() * Qj)).vec();
     residuals.block<3, 1>(O_V, 0) = Qi.inverse() * (g * sum_dt + Vj - Vi) - corrected_delta_v;
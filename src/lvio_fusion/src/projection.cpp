@@ -8,27 +8,28 @@
 namespace lvio_fusion
 {
 
+// reset images in place, points_full is not refilled because it is only read where range_mat is set
 void ImageProjection::Clear()
 {
-    range_mat = cv::Mat(num_scans_, horizon_scan_, CV_32F, cv::Scalar::all(FLT_MAX));
-    ground_mat = cv::Mat(num_scans_, horizon_scan_, CV_8S, cv::Scalar::all(0));
-    label_mat = cv::Mat(num_scans_, horizon_scan_, CV_32S, cv::Scalar::all(0));
+    range_mat.setTo(cv::Scalar::all(FLT_MAX));
+    ground_mat.setTo(cv::Scalar::all(0));
+    label_mat.setTo(cv::Scalar::all(0));
     label_count = 1;
-    PointI nan; // fill in fullCloud at each iteration
-    nan.x = std::numeric_limits<float>::quiet_NaN();
-    nan.y = std::numeric_limits<float>::quiet_NaN();
-    nan.z = std::numeric_limits<float>::quiet_NaN();
-    nan.intensity = -1;
-    std::fill(points_full.points.begin(), points_full.points.end(), nan);
 }
 
-SegmentedInfo ImageProjection::Process(PointICloud &points, PointICloud &points_segmented)
+/**
+ * @param points            points of a sweep
+ * @param points_segmented  output
+ * @param has_ring          whether the ring of points is published by the driver, it is used as the row if ring_order is set
+ * @return information of the segmented points
+ */
+SegmentedInfo &ImageProjection::Process(PointICloud &points, PointICloud &points_segmented, bool has_ring)
 {
-    SegmentedInfo segmented_info(num_scans_, horizon_scan_);
+    SegmentedInfo &segmented_info = segmented_info_;
 
     FindStartEndAngle(segmented_info, points);
 
-    ProjectPointCloud(segmented_info, points);
+    ProjectPointCloud(segmented_info, points, has_ring);
 
     RemoveGround(segmented_info);
 
@@ -54,52 +55,69 @@ void ImageProjection::FindStartEndAngle(SegmentedInfo &segmented_info, PointIClo
     segmented_info.orientation_diff = segmented_info.end_orientation - segmented_info.start_orientation;
 }
 
-void ImageProjection::ProjectPointCloud(SegmentedInfo &segmented_info, PointICloud &points)
+void ImageProjection::ProjectPointCloud(SegmentedInfo &segmented_info, PointICloud &points, bool has_ring)
 {
     // range image projection
-    float vertical_angle, horizon_angle, range;
-    size_t row_ind, column_ind, index, size;
-    PointI point;
-
-    size = points.points.size();
-
+    const size_t size = points.points.size();
+    const float to_degree = 180 / M_PI;
+    rows_.resize(size);
+    cols_.resize(size);
+    ranges_.resize(size);
+    const PointI *p = points.points.data();
+    int *rows = rows_.data(), *cols = cols_.data();
+    float *ranges = ranges_.data();
+
+    // find the row and column index in the image for all points, no branches so it can be vectorized
     for (size_t i = 0; i < size; ++i)
     {
-        point.x = points[i].x;
-        point.y = points[i].y;
-        point.z = points[i].z;
-        // find the row and column index in the image for this point
-
-        vertical_angle = atan2(point.z, sqrt(point.x * point.x + point.y * point.y)) * 180 / M_PI;
-        row_ind = (vertical_angle + ang_bottom_) / ang_res_y_;
-
-        if (row_ind < 0 || row_ind >= num_scans_)
-            continue;
-
-        horizon_angle = atan2(point.x, point.y) * 180 / M_PI;
-
-        column_ind = -round((horizon_angle - 90.0) / ang_res_x_) + horizon_scan_ / 2;
-        if (column_ind >= horizon_scan_)
-            column_ind -= horizon_scan_;
+        float x = p[i].data[0], y = p[i].data[1], z = p[i].data[2];
+        float xy2 = x * x + y * y;
+        float vertical_angle = fast_atan2(z, std::sqrt(xy2)) * to_degree;
+        float row = (vertical_angle + ang_bottom_) / ang_res_y_;
+        rows[i] = (row >= 0) & (row < num_scans_) ? (int)row : -1;
+
+        float horizon_angle = fast_atan2(x, y) * to_degree;
+        // round by truncating a positive number, (horizon_angle - 90) / ang_res_x_ >= -0.75 * horizon_scan_
+        int col = 2 * horizon_scan_ - (int)((horizon_angle - 90.0f) / ang_res_x_ + 0.5f + 2 * horizon_scan_) + horizon_scan_ / 2;
+        col = col >= horizon_scan_ ? col - horizon_scan_ : col;
+        cols[i] = (col >= 0) & (col < horizon_scan_) ? col : -1;
+
+        ranges[i] = std::sqrt(xy2 + z * z);
+    }
+#ifdef CHECK_EQUIVALENCE
+    // check the approximation against std::atan2 if CHECK_EQUIVALENCE is defined, signed zeros may flip pi to -pi
+    for (size_t i = 0; i < size; ++i)
+    {
+        float x = p[i].data[0], y = p[i].data[1];
+        assert((x == 0 && y == 0) || std::abs(std::remainder(fast_atan2(x, y) - std::atan2(x, y), 2 * M_PI)) < 1e-5);
+    }
+#endif
+    if (has_ring && ring_order_ != 0)
+    {
+        // the computed row counts from the lowest beam, drivers differ in the order of rings
+        for (size_t i = 0; i < size; ++i)
+        {
+            int row = ring_order_ > 0 ? (int)p[i].ring : num_scans_ - 1 - (int)p[i].ring;
+            rows[i] = (row >= 0) & (row < num_scans_) ? row : -1;
+        }
+    }
 
-        if (column_ind < 0 || column_ind >= horizon_scan_)
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (rows[i] < 0 || cols[i] < 0)
             continue;
-
-        range = sqrt(point.x * point.x + point.y * point.y + point.z * point.z);
-
-        range_mat.at<float>(row_ind, column_ind) = range;
-
-        point.intensity = (float)row_ind + (float)column_ind / 10000.0;
-
-        index = column_ind + row_ind * horizon_scan_;
-        points_full[index] = point;
+        range_mat.at<float>(rows[i], cols[i]) = ranges[i];
+        PointI &point = points_full[cols[i] + rows[i] * horizon_scan_];
+        point = p[i];
+        point.ring = rows[i];
     }
 }
 
 void ImageProjection::RemoveGround(SegmentedInfo &segmented_info)
 {
+    static const float tan2_ground = pow(tan(10.0 / 180 * M_PI), 2);
     size_t lower_ind, upper_ind;
-    float dx, dy, dz, angle;
+    float dx, dy, dz;
     // groundMat
     // -1, no valid info to check if ground of not
     //  0, initial value, after validation, means not ground
@@ -112,8 +130,8 @@ void ImageProjection::RemoveGround(SegmentedInfo &segmented_info)
             lower_ind = j + (i)*horizon_scan_;
             upper_ind = j + (i + 1) * horizon_scan_;
 
-            if (points_full[lower_ind].intensity == -1 ||
-                points_full[upper_ind].intensity == -1)
+            if (range_mat.at<float>(i, j) == FLT_MAX ||
+                range_mat.at<float>(i + 1, j) == FLT_MAX)
             {
                 // no info to check, invalid points
                 ground_mat.at<int8_t>(i, j) = -1;
@@ -124,10 +142,8 @@ void ImageProjection::RemoveGround(SegmentedInfo &segmented_info)
             dy = points_full[upper_ind].y - points_full[lower_ind].y;
             dz = points_full[upper_ind].z - points_full[lower_ind].z;
 
-            angle = atan2(dz, sqrt(dx * dx + dy * dy)) * 180 / M_PI;
-
-            //NOTE: mount angle
-            if (abs(angle) <= 10)
+            //NOTE: mount angle, same as abs(atan2(dz, sqrt(dx * dx + dy * dy))) <= 10 degrees
+            if (dz * dz <= tan2_ground * (dx * dx + dy * dy))
             {
                 ground_mat.at<int8_t>(i, j) = 1;
                 ground_mat.at<int8_t>(i + 1, j) = 1;
@@ -152,10 +168,7 @@ void ImageProjection::RemoveGround(SegmentedInfo &segmented_info)
 void ImageProjection::Segment(SegmentedInfo &segmented_info, PointICloud &points_segmented)
 {
     // segmentation process
-    for (size_t i = 0; i < num_scans_; ++i)
-        for (size_t j = 0; j < horizon_scan_; ++j)
-            if (label_mat.at<int>(i, j) == 0)
-                LabelComponents(i, j);
+    LabelComponents();
 
     int num_segmented = 0;
     // extract segmented cloud for lidar odometry
@@ -196,125 +209,118 @@ void ImageProjection::Segment(SegmentedInfo &segmented_info, PointICloud &points
     }
 }
 
-void ImageProjection::LabelComponents(int row, int col)
+int ImageProjection::Find(int i)
 {
-    static uint16_t *all_pushed_ind_X = new uint16_t[num_scans_ * horizon_scan_]; // array for tracking points of a segmented object
-    static uint16_t *all_pushed_ind_y = new uint16_t[num_scans_ * horizon_scan_];
-    static uint16_t *queue_ind_x = new uint16_t[num_scans_ * horizon_scan_]; // array for breadth-first search process of segmentation, for speed
-    static uint16_t *queue_ind_y = new uint16_t[num_scans_ * horizon_scan_];
-    static std::vector<std::pair<int8_t, int8_t>> neighbors; // neighbor iterator for segmentaiton process
-    if (neighbors.empty())
+    while (parents_[i] != i)
     {
-        std::pair<int8_t, int8_t> neighbor;
-        neighbor.first = -1;
-        neighbor.second = 0;
-        neighbors.push_back(neighbor);
-        neighbor.first = 0;
-        neighbor.second = 1;
-        neighbors.push_back(neighbor);
-        neighbor.first = 0;
-        neighbor.second = -1;
-        neighbors.push_back(neighbor);
-        neighbor.first = 1;
-        neighbor.second = 0;
-        neighbors.push_back(neighbor);
+        parents_[i] = parents_[parents_[i]];
+        i = parents_[i];
     }
+    return i;
+}
 
-    // use std::queue std::vector std::deque will slow the program down greatly
-    float d1, d2, alpha, angle;
-    int from_ind_x, from_ind_y, this_ind_x, this_ind_y;
-    std::vector<bool> line_count_flag(num_scans_, false);
+// the smaller index is the root, so a root is the first pixel of its component in row-major order
+void ImageProjection::Union(int a, int b)
+{
+    a = Find(a);
+    b = Find(b);
+    if (a < b)
+        parents_[b] = a;
+    else if (b < a)
+        parents_[a] = b;
+}
 
-    queue_ind_x[0] = row;
-    queue_ind_y[0] = col;
-    int queue_size = 1;
-    int queue_start_ind = 0;
-    int queue_end_ind = 1;
+// same as atan2(d2 * sin(alpha), d1 - d2 * cos(alpha)) > theta, d1 is the larger range
+inline bool is_connected(float r1, float r2, float factor)
+{
+    return std::max(r1, r2) < std::min(r1, r2) * factor;
+}
 
-    all_pushed_ind_X[0] = row;
-    all_pushed_ind_y[0] = col;
-    int all_pushed_ind_size = 1;
+/**
+ * two-pass connected components labeling of unlabeled pixels with union-find:
+ * runs in rows are linked in parallel, then rows are merged,
+ * at last components are labeled, or marked as outliers if they are too small.
+ */
+void ImageProjection::LabelComponents()
+{
+    int *parents = parents_.data();
+    cv::parallel_for_(cv::Range(0, num_scans_), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; ++i)
+        {
+            const int *label = label_mat.ptr<int>(i);
+            const float *r = range_mat.ptr<float>(i);
+            const int offset = i * horizon_scan_;
+            parents[offset] = offset;
+            for (int j = 1; j < horizon_scan_; ++j)
+            {
+                bool linked = label[j] == 0 && label[j - 1] == 0 && is_connected(r[j - 1], r[j], connect_x_);
+                parents[offset + j] = linked ? parents[offset + j - 1] : offset + j;
+            }
+            // at range image margin (left or right side), only pixels of this row are touched
+            const int last = horizon_scan_ - 1;
+            if (label[0] == 0 && label[last] == 0 && is_connected(r[last], r[0], connect_x_))
+            {
+                Union(offset, offset + last);
+            }
+        }
+    });
 
-    while (queue_size > 0)
+    for (int i = 0; i < num_scans_ - 1; ++i)
     {
-        // Pop point
-        from_ind_x = queue_ind_x[queue_start_ind];
-        from_ind_y = queue_ind_y[queue_start_ind];
-        --queue_size;
-        ++queue_start_ind;
-        // Mark popped point
-        label_mat.at<int>(from_ind_x, from_ind_y) = label_count;
-        // Loop through all the neighboring grids of popped grid
-        for (auto iter = neighbors.begin(); iter != neighbors.end(); ++iter)
+        const int *label0 = label_mat.ptr<int>(i), *label1 = label_mat.ptr<int>(i + 1);
+        const float *r0 = range_mat.ptr<float>(i), *r1 = range_mat.ptr<float>(i + 1);
+        for (int j = 0; j < horizon_scan_; ++j)
         {
-            // new index
-            this_ind_x = from_ind_x + (*iter).first;
-            this_ind_y = from_ind_y + (*iter).second;
-            // index should be within the boundary
-            if (this_ind_x < 0 || this_ind_x >= num_scans_)
-                continue;
-            // at range image margin (left or right side)
-            if (this_ind_y < 0)
-                this_ind_y = horizon_scan_ - 1;
-            if (this_ind_y >= horizon_scan_)
-                this_ind_y = 0;
-            // prevent infinite loop (caused by put already examined point back)
-            if (label_mat.at<int>(this_ind_x, this_ind_y) != 0)
-                continue;
-
-            d1 = std::max(range_mat.at<float>(from_ind_x, from_ind_y),
-                          range_mat.at<float>(this_ind_x, this_ind_y));
-            d2 = std::min(range_mat.at<float>(from_ind_x, from_ind_y),
-                          range_mat.at<float>(this_ind_x, this_ind_y));
-
-            if ((*iter).first == 0)
-                alpha = segment_alpha_x_;
-            else
-                alpha = segment_alpha_y_;
-
-            angle = atan2(d2 * sin(alpha), (d1 - d2 * cos(alpha)));
-
-            if (angle > theta)
+            if (label0[j] == 0 && label1[j] == 0 && is_connected(r0[j], r1[j], connect_y_))
             {
-
-                queue_ind_x[queue_end_ind] = this_ind_x;
-                queue_ind_y[queue_end_ind] = this_ind_y;
-                ++queue_size;
-                ++queue_end_ind;
-
-                label_mat.at<int>(this_ind_x, this_ind_y) = label_count;
-                line_count_flag[this_ind_x] = true;
-
-                all_pushed_ind_X[all_pushed_ind_size] = this_ind_x;
-                all_pushed_ind_y[all_pushed_ind_size] = this_ind_y;
-                ++all_pushed_ind_size;
+                Union(i * horizon_scan_ + j, (i + 1) * horizon_scan_ + j);
             }
         }
     }
 
-    // check if this segment is valid
-    bool feasible_segment = false;
-    if (all_pushed_ind_size >= 30)
-        feasible_segment = true;
-    else if (all_pushed_ind_size >= num_segment_valid_points_)
+    // a root is visited before other pixels of its component
+    for (int i = 0; i < num_scans_; ++i)
     {
-        int count = 0;
-        for (size_t i = 0; i < num_scans_; ++i)
-            if (line_count_flag[i] == true)
-                ++count;
-        if (count >= num_segment_valid_lines_)
-            feasible_segment = true;
+        const int *label = label_mat.ptr<int>(i);
+        for (int j = 0; j < horizon_scan_; ++j)
+        {
+            int index = i * horizon_scan_ + j;
+            if (label[j] != 0)
+                continue;
+            int root = Find(index);
+            parents_[index] = root;
+            Component &component = components_[root];
+            if (root == index)
+            {
+                component = Component();
+            }
+            component.size++;
+            // the line of the root is counted only if other pixels are in it, same as the breadth-first labeling
+            if (root != index && component.last_line != i)
+            {
+                component.last_line = i;
+                component.num_lines++;
+            }
+        }
     }
-    // segment is valid, mark these points
-    if (feasible_segment == true)
+
+    // check if segments are valid
+    for (int i = 0; i < num_scans_; ++i)
     {
-        ++label_count;
-    }
-    else
-    { // segment is invalid, mark these points
-        for (size_t i = 0; i < all_pushed_ind_size; ++i)
+        int *label = label_mat.ptr<int>(i);
+        for (int j = 0; j < horizon_scan_; ++j)
         {
-            label_mat.at<int>(all_pushed_ind_X[i], all_pushed_ind_y[i]) = OUTLIER_LABEL;
+            int index = i * horizon_scan_ + j;
+            if (label[j] != 0)
+                continue;
+            Component &component = components_[parents_[index]];
+            if (parents_[index] == index)
+            {
+                bool feasible_segment = component.size >= 30 ||
+                                        (component.size >= num_segment_valid_points_ && component.num_lines >= num_segment_valid_lines_);
+                component.label = feasible_segment ? label_count++ : OUTLIER_LABEL;
+            }
+            label[j] = component.label;
         }
     }
 }
@@ -0,0 +1,145 @@
+#include "lvio_fusion/imu/propagator.h"
+#include "lvio_fusion/imu/imu.h"
+
+namespace lvio_fusion
+{
+namespace imu
+{
+
+// before the imu is initialized, gravity and biases are unknown, so only visual states are output
+inline bool can_propagate()
+{
+    return Imu::Num() && Imu::Get()->initialized;
+}
+
+void Propagator::Subscribe(Callback callback)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    callbacks_.push_back(callback);
+}
+
+/**
+ * reset the state to the newest tracked frame, and repropagate the samples received after it
+ * @param time      time of the frame
+ * @param pose      pose of the frame
+ * @param ba        bias of accelerometer
+ * @param bg        bias of gyroscope
+ * @param velocity  velocity of the frame propagated from the optimized state, null before the imu is initialized
+ */
+void Propagator::SetState(double time, const SE3d &pose, const Vector3d &ba, const Vector3d &bg, const Vector3d *velocity)
+{
+    TimePoint input_time = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (has_state_ && time <= state_time_)
+        return;
+
+    // fall back to the finite difference of poses of tracked frames
+    Vector3d v = Vector3d::Zero();
+    if (velocity)
+    {
+        v = *velocity;
+    }
+    else if (has_state_)
+    {
+        v = (pose.translation() - state_pose_.translation()) / (time - state_time_);
+    }
+    has_state_ = true;
+    state_time_ = time;
+    state_pose_ = pose;
+    ba_ = ba;
+    bg_ = bg;
+
+    time_ = time;
+    pose_ = pose;
+    velocity_ = v;
+
+    // keep the last sample before the frame as the start of mid-point integration
+    while (buf_.size() > 1 && buf_[1].time <= time)
+    {
+        buf_.pop_front();
+    }
+    if (!buf_.empty())
+    {
+        acc_ = buf_.front().acc;
+        gyr_ = buf_.front().gyr;
+        if (can_propagate())
+        {
+            for (auto &m : buf_)
+            {
+                Propagate(m);
+            }
+        }
+    }
+    Emit(input_time, lock);
+}
+
+void Propagator::Reset()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    has_state_ = false;
+}
+
+void Propagator::AddImu(double time, const Vector3d &acc, const Vector3d &gyr)
+{
+    TimePoint input_time = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!buf_.empty() && time <= buf_.back().time)
+        return;
+    buf_.push_back({time, acc, gyr});
+    if (buf_.size() > capacity_)
+    {
+        buf_.pop_front();
+    }
+
+    if (!has_state_ || !can_propagate())
+        return;
+    if (buf_.size() == 1)
+    {
+        acc_ = acc;
+        gyr_ = gyr;
+    }
+    Propagate(buf_.back());
+    Emit(input_time, lock);
+}
+
+// mid-point integration in the world frame, the caller holds mutex_
+void Propagator::Propagate(const Measurement &m)
+{
+    double dt = m.time - time_;
+    if (dt <= 0)
+        return;
+    Vector3d un_acc_0 = pose_.so3() * (acc_ - ba_) - imu::g;
+    Vector3d un_gyr = 0.5 * (gyr_ + m.gyr) - bg_;
+    SO3d R = pose_.so3() * SO3d::exp(un_gyr * dt);
+    Vector3d un_acc_1 = R * (m.acc - ba_) - imu::g;
+    Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
+    pose_.translation() += dt * velocity_ + 0.5 * dt * dt * un_acc;
+    pose_.so3() = R;
+    velocity_ += dt * un_acc;
+    time_ = m.time;
+    acc_ = m.acc;
+    gyr_ = m.gyr;
+}
+
+// callbacks are called outside the lock, so that they can be slow or reentrant
+void Propagator::Emit(const TimePoint &input_time, std::unique_lock<std::mutex> &lock)
+{
+    if (callbacks_.empty())
+        return;
+    Odometry odometry;
+    odometry.time = time_;
+    odometry.pose = pose_;
+    odometry.velocity = velocity_;
+    odometry.age = time_ - state_time_;
+    std::vector<Callback> callbacks = callbacks_;
+    lock.unlock();
+
+    odometry.latency = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - input_time).count();
+    for (auto &callback : callbacks)
+    {
+        callback(odometry);
+    }
+}
+
+} // namespace imu
+} // namespace lvio_fusion
@@ -0,0 +1,89 @@
+#include "lvio_fusion/lidar/scan_buffer.h"
+
+namespace lvio_fusion
+{
+
+/**
+ * @param time          time of the scan
+ * @param scan          raw points
+ * @param has_time      whether the time field of points is published by the driver, it is the offset from the time of the scan
+ */
+void ScanBuffer::Push(double time, PointICloud::Ptr scan, bool has_time)
+{
+    if (!scans_.empty() && time <= scans_.back().time)
+        return;
+    Scan new_scan{time, time - cycle_time_ / 2, time + cycle_time_ / 2, scan, has_time && !scan->empty()};
+    if (new_scan.has_time)
+    {
+        // points are not sorted by time in all drivers, e.g. ouster publishes them ring by ring
+        float min_time = FLT_MAX, max_time = -FLT_MAX;
+        for (auto &point : scan->points)
+        {
+            min_time = std::min(min_time, point.time);
+            max_time = std::max(max_time, point.time);
+        }
+        new_scan.start_time = time + min_time;
+        new_scan.end_time = time + max_time;
+    }
+    scans_.push_back(new_scan);
+    if (scans_.size() > capacity_)
+    {
+        scans_.pop_front();
+    }
+}
+
+/**
+ * extract the points in [start_time, end_time),
+ * spans of scans with the time of points are whole scans, their points are selected by time when they are read
+ * @param start_time
+ * @param end_time
+ * @param view          output
+ * @return false if the scans don't cover the time range yet
+ */
+bool ScanBuffer::Extract(double start_time, double end_time, View &view)
+{
+    view.clear();
+    if (scans_.empty() || start_time < scans_.front().start_time || end_time > scans_.back().end_time)
+        return false;
+
+    for (auto &scan : scans_)
+    {
+        size_t size = scan.points->size();
+        if (scan.end_time < start_time || scan.start_time >= end_time || size == 0)
+            continue;
+        Span span;
+        span.scan = scan.points;
+        span.has_time = scan.has_time;
+        if (scan.has_time)
+        {
+            span.time = scan.time;
+            span.dt = 0;
+            span.begin = 0;
+            span.end = size;
+        }
+        else
+        {
+            double dt = cycle_time_ / size;
+            span.time = scan.start_time;
+            span.dt = dt;
+            span.begin = start_time > scan.start_time ? std::min((size_t)ceil((start_time - scan.start_time) / dt - epsilon), size) : 0;
+            span.end = end_time < scan.end_time ? std::min((size_t)ceil((end_time - scan.start_time) / dt - epsilon), size) : size;
+        }
+        if (span.begin < span.end)
+        {
+            view.push_back(span);
+        }
+    }
+    return true;
+}
+
+// release the scans which end before the time
+void ScanBuffer::Release(double time)
+{
+    while (!scans_.empty() && scans_.front().end_time < time)
+    {
+        scans_.pop_front();
+    }
+}
+
+} // namespace lvio_fusion
@@ -0,0 +1,301 @@
+#include "lvio_fusion/lidar/tiles.h"
+
+#include <fstream>
+#include <sys/stat.h>
+
+namespace lvio_fusion
+{
+
+/**
+ * @param size          side length of a tile in meters
+ * @param num_tiles     max number of hot tiles in memory, 0 means unlimited
+ * @param path          directory of spilled tiles, empty means only world pointclouds of evicted tiles are dropped
+ */
+MapTiles::MapTiles(double size, int num_tiles, const std::string &path)
+    : size_(size), num_tiles_(num_tiles), path_(path)
+{
+    if (!path_.empty())
+    {
+        mkdir(path_.c_str(), 0755);
+    }
+}
+
+MapTiles::Key MapTiles::ToKey(const Vector3d &position)
+{
+    return Key(floor(position.x() / size_), floor(position.y() / size_));
+}
+
+std::string MapTiles::FileName(const Key &key)
+{
+    return path_ + "/tile_" + std::to_string(key.first) + "_" + std::to_string(key.second) + ".bin";
+}
+
+// the entry of the keyframe, it is moved to another tile after its pose is corrected
+MapTiles::Entry &MapTiles::Find(double time, const SE3d &pose)
+{
+    Key key = ToKey(pose.translation());
+    auto iter = locations_.find(time);
+    if (iter != locations_.end() && iter->second != key)
+    {
+        Tile &old_tile = Load(iter->second);
+        Entry entry = std::move(old_tile.entries[time]);
+        old_tile.entries.erase(time);
+        old_tile.saved = false;
+        Tile &tile = Load(key);
+        tile.entries[time] = std::move(entry);
+    }
+
+    Tile &tile = Load(key);
+    tile.saved = false;
+    locations_[time] = key;
+    if (time >= latest_time_)
+    {
+        latest_time_ = time;
+        center_ = key;
+    }
+    return tile.entries[time];
+}
+
+void MapTiles::Insert(double time, const SE3d &pose, const PointICloud &points_surf, const PointICloud &points_ground)
+{
+    Entry &entry = Find(time, pose);
+    entry.cached = true;
+    entry.pose = pose;
+    entry.points_surf = points_surf;
+    entry.points_ground = points_ground;
+    Evict();
+}
+
+bool MapTiles::Get(double time, SE3d &pose, PointICloud &points_surf, PointICloud &points_ground)
+{
+    auto iter = locations_.find(time);
+    if (iter == locations_.end())
+        return false;
+    Tile &tile = Load(iter->second);
+    Entry &entry = tile.entries[time];
+    bool cached = entry.cached;
+    if (cached)
+    {
+        pose = entry.pose;
+        points_surf = entry.points_surf;
+        points_ground = entry.points_ground;
+    }
+    Evict();
+    return cached;
+}
+
+/**
+ * take the lidar features of a finalized keyframe, the frame should release them then
+ * @param time      time of the keyframe
+ * @param pose      pose of the keyframe, decides the tile
+ * @param feature   lidar features in the body frame
+ */
+void MapTiles::InsertFeature(double time, const SE3d &pose, lidar::Feature::Ptr feature)
+{
+    Entry &entry = Find(time, pose);
+    entry.feature = feature;
+    Evict();
+}
+
+// lidar features of a finalized keyframe, paged in from disk if its tile is spilled
+lidar::Feature::Ptr MapTiles::GetFeature(double time)
+{
+    auto iter = locations_.find(time);
+    if (iter == locations_.end())
+        return nullptr;
+    Tile &tile = Load(iter->second);
+    lidar::Feature::Ptr feature = tile.entries[time].feature;
+    Evict();
+    return feature;
+}
+
+MapTiles::Tile &MapTiles::Load(const Key &key)
+{
+    auto iter = tiles_.find(key);
+    if (iter != tiles_.end())
+    {
+        Tile &tile = iter->second;
+        if (tile.hot)
+        {
+            lru_.splice(lru_.begin(), lru_, tile.lru);
+        }
+        else
+        {
+            lru_.push_front(key);
+            tile.lru = lru_.begin();
+            tile.hot = true;
+        }
+        return tile;
+    }
+
+    Tile &tile = tiles_[key];
+    if (spilled_.erase(key))
+    {
+        tile.saved = Read(key, tile.entries);
+    }
+    lru_.push_front(key);
+    tile.lru = lru_.begin();
+    tile.hot = true;
+    return tile;
+}
+
+// spill the least recently used tiles or drop their world pointclouds, except the neighbors of the vehicle
+void MapTiles::Evict()
+{
+    if (num_tiles_ <= 0)
+        return;
+    auto iter = lru_.end();
+    while (lru_.size() > num_tiles_ && iter != lru_.begin())
+    {
+        iter--;
+        Key key = *iter;
+        if (abs(key.first - center_.first) <= 1 && abs(key.second - center_.second) <= 1)
+            continue;
+
+        Tile &tile = tiles_[key];
+        iter = lru_.erase(iter);
+        tile.hot = false;
+        if (path_.empty())
+        {
+            // lidar features stay in memory, world pointclouds are transformed again when they are requested
+            for (auto entry_iter = tile.entries.begin(); entry_iter != tile.entries.end();)
+            {
+                Entry &entry = entry_iter->second;
+                if (entry.feature)
+                {
+                    entry.cached = false;
+                    PointICloud().swap(entry.points_surf);
+                    PointICloud().swap(entry.points_ground);
+                    entry_iter++;
+                }
+                else
+                {
+                    locations_.erase(entry_iter->first);
+                    entry_iter = tile.entries.erase(entry_iter);
+                }
+            }
+            if (tile.entries.empty())
+            {
+                tiles_.erase(key);
+            }
+            continue;
+        }
+
+        if (tile.entries.empty())
+        {
+            remove(FileName(key).c_str());
+        }
+        else
+        {
+            if (!tile.saved)
+            {
+                Write(key, tile.entries);
+            }
+            spilled_.insert(key);
+        }
+        tiles_.erase(key);
+    }
+}
+
+inline void write_points(std::ofstream &file, const PointICloud &points_surf, const PointICloud &points_ground)
+{
+    uint32_t num_surf = points_surf.size();
+    uint32_t num_ground = points_ground.size();
+    file.write(reinterpret_cast<const char *>(&num_surf), sizeof(num_surf));
+    file.write(reinterpret_cast<const char *>(&num_ground), sizeof(num_ground));
+    for (auto pc : {&points_surf, &points_ground})
+    {
+        for (auto &point : pc->points)
+        {
+            float xyzi[4] = {point.x, point.y, point.z, point.intensity};
+            file.write(reinterpret_cast<const char *>(xyzi), sizeof(xyzi));
+        }
+    }
+}
+
+inline void read_points(std::ifstream &file, PointICloud &points_surf, PointICloud &points_ground)
+{
+    uint32_t num_surf = 0, num_ground = 0;
+    file.read(reinterpret_cast<char *>(&num_surf), sizeof(num_surf));
+    file.read(reinterpret_cast<char *>(&num_ground), sizeof(num_ground));
+    if (!file)
+        return;
+    std::vector<float> xyzi(4 * (num_surf + num_ground));
+    file.read(reinterpret_cast<char *>(xyzi.data()), xyzi.size() * sizeof(float));
+    for (uint32_t j = 0; j < num_surf + num_ground; j++)
+    {
+        PointI point;
+        point.x = xyzi[4 * j];
+        point.y = xyzi[4 * j + 1];
+        point.z = xyzi[4 * j + 2];
+        point.intensity = xyzi[4 * j + 3];
+        (j < num_surf ? points_surf : points_ground).push_back(point);
+    }
+}
+
+/**
+ * file of a tile, world pointclouds are saved if they are cached, lidar features are saved if they are owned:
+ * n(u32), [time(f64), pose(7 x f64), cached(u8), owned(u8), [n_surf(u32), n_ground(u32), [x, y, z, intensity(4 x f32)] x (n_surf + n_ground)] x (cached + owned)] x n
+ */
+void MapTiles::Write(const Key &key, const std::map<double, Entry> &entries)
+{
+    std::ofstream file(FileName(key), std::ios::binary | std::ios::trunc);
+    uint32_t n = entries.size();
+    file.write(reinterpret_cast<const char *>(&n), sizeof(n));
+    for (auto &pair_entry : entries)
+    {
+        const Entry &entry = pair_entry.second;
+        uint8_t cached = entry.cached, owned = entry.feature != nullptr;
+        file.write(reinterpret_cast<const char *>(&pair_entry.first), sizeof(double));
+        file.write(reinterpret_cast<const char *>(entry.pose.data()), SE3d::num_parameters * sizeof(double));
+        file.write(reinterpret_cast<const char *>(&cached), sizeof(cached));
+        file.write(reinterpret_cast<const char *>(&owned), sizeof(owned));
+        if (cached)
+        {
+            write_points(file, entry.points_surf, entry.points_ground);
+        }
+        if (owned)
+        {
+            write_points(file, entry.feature->points_surf, entry.feature->points_ground);
+        }
+    }
+}
+
+bool MapTiles::Read(const Key &key, std::map<double, Entry> &entries)
+{
+    std::ifstream file(FileName(key), std::ios::binary);
+    uint32_t n = 0;
+    file.read(reinterpret_cast<char *>(&n), sizeof(n));
+    for (uint32_t i = 0; i < n && file; i++)
+    {
+        double time;
+        SE3d pose;
+        uint8_t cached, owned;
+        file.read(reinterpret_cast<char *>(&time), sizeof(time));
+        file.read(reinterpret_cast<char *>(pose.data()), SE3d::num_parameters * sizeof(double));
+        file.read(reinterpret_cast<char *>(&cached), sizeof(cached));
+        file.read(reinterpret_cast<char *>(&owned), sizeof(owned));
+        if (!file)
+            break;
+        Entry &entry = entries[time];
+        entry.pose = pose;
+        entry.cached = cached;
+        if (cached)
+        {
+            read_points(file, entry.points_surf, entry.points_ground);
+        }
+        if (owned)
+        {
+            entry.feature = lidar::Feature::Create();
+            read_points(file, entry.feature->points_surf, entry.feature->points_ground);
+        }
+    }
+    if (!file)
+    {
+        LOG(WARNING) << "Failed to read map tile: " << FileName(key);
+        return false;
+    }
+    return true;
+}
+
+} // namespace lvio_fusion
@@ -0,0 +1,37 @@
+#include "lvio_fusion/trajectory.h"
+#include "lvio_fusion/map.h"
+
+namespace lvio_fusion
+{
+
+void Trajectory::MarkChanged(const Frames &kfs)
+{
+    if (kfs.empty())
+        return;
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_kfs_.insert(kfs.begin(), kfs.end());
+    latest_time_ = std::max(latest_time_, kfs.rbegin()->first);
+}
+
+Frames Trajectory::GetChanges()
+{
+    Frames changed_kfs;
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_kfs.swap(changed_kfs_);
+    return changed_kfs;
+}
+
+// keyframes in the window before the latest keyframe
+Frames Trajectory::GetRecent()
+{
+    double start;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (latest_time_ == 0)
+            return Frames();
+        start = latest_time_ - window_;
+    }
+    return Map::Instance().GetKeyFrames(start);
+}
+
+} // namespace lvio_fusion
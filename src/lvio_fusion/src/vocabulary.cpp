@@ -0,0 +1,82 @@
+#include "lvio_fusion/loop/vocabulary.h"
+
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lvio_fusion
+{
+namespace loop
+{
+
+// signature of DBoW3 binary vocabularies
+const uint64_t binary_signature = 88877711233;
+
+// read-only stream buffer over a memory block, no copy
+class MemoryBuffer : public std::streambuf
+{
+public:
+    MemoryBuffer(char *data, size_t size)
+    {
+        setg(data, data, data + size);
+    }
+};
+
+/**
+ * load a vocabulary, binary vocabularies are read from a memory mapped file,
+ * other formats are parsed by DBoW3
+ * @param path      path of the vocabulary
+ * @param voc       output vocabulary
+ */
+void LoadVocabulary(const std::string &path, DBoW3::Vocabulary &voc)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(binary_signature))
+    {
+        if (fd >= 0)
+            close(fd);
+        voc.load(path);
+        return;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        voc.load(path);
+        return;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    if (*reinterpret_cast<uint64_t *>(data) == binary_signature)
+    {
+        MemoryBuffer buffer(static_cast<char *>(data), st.st_size);
+        std::istream stream(&buffer);
+        voc.fromStream(stream);
+        munmap(data, st.st_size);
+    }
+    else
+    {
+        munmap(data, st.st_size);
+        voc.load(path);
+    }
+}
+
+/**
+ * convert a vocabulary of any format to the uncompressed binary format, which is the fastest to load
+ * @param input     path of the source vocabulary
+ * @param output    path of the binary vocabulary
+ */
+void ConvertVocabulary(const std::string &input, const std::string &output)
+{
+    DBoW3::Vocabulary voc;
+    voc.load(input);
+    std::ofstream file(output, std::ios::binary);
+    voc.toStream(file, false);
+}
+
+} // namespace loop
+} // namespace lvio_fusion
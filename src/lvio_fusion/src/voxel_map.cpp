@@ -0,0 +1,132 @@
+#include "lvio_fusion/lidar/voxel_map.h"
+
+namespace lvio_fusion
+{
+
+inline int floor_div(int a, int b)
+{
+    return a >= 0 ? a / b : (a - b + 1) / b;
+}
+
+VoxelKey VoxelMap::ToRegion(const VoxelKey &key)
+{
+    return VoxelKey{floor_div(key.x, region_size_), floor_div(key.y, region_size_), floor_div(key.z, region_size_)};
+}
+
+void VoxelMap::Add(const PointICloud &points, bool ground, std::unordered_map<VoxelKey, Voxel, VoxelKeyHash> &voxels)
+{
+    for (auto &point : points)
+    {
+        VoxelKey key{(int)floor(point.x / resolution_), (int)floor(point.y / resolution_), (int)floor(point.z / resolution_)};
+        Voxel &voxel = voxels[key];
+        voxel.sum += Vector3d(point.x, point.y, point.z);
+        voxel.num++;
+        voxel.num_ground += ground;
+    }
+}
+
+/**
+ * insert world pointclouds of a keyframe, the old contribution of the keyframe is replaced
+ * @param time              time of the keyframe
+ * @param pose              pose of the keyframe when the pointclouds are transformed
+ * @param points_surf       world pointcloud
+ * @param points_ground     world pointcloud
+ */
+void VoxelMap::Insert(double time, const SE3d &pose, const PointICloud &points_surf, const PointICloud &points_ground)
+{
+    Remove(time);
+    Contribution &contribution = contributions_[time];
+    contribution.pose = pose;
+    Add(points_surf, false, contribution.voxels);
+    Add(points_ground, true, contribution.voxels);
+    for (auto &pair_voxel : contribution.voxels)
+    {
+        VoxelKey region_key = ToRegion(pair_voxel.first);
+        auto iter = regions_.find(region_key);
+        if (iter == regions_.end())
+        {
+            iter = regions_.insert(std::make_pair(region_key, Region())).first;
+            iter->second.id = num_regions_++;
+        }
+        Voxel &voxel = iter->second.voxels[pair_voxel.first];
+        voxel.sum += pair_voxel.second.sum;
+        voxel.num += pair_voxel.second.num;
+        voxel.num_ground += pair_voxel.second.num_ground;
+        changed_regions_.insert(region_key);
+    }
+}
+
+void VoxelMap::Remove(double time)
+{
+    auto iter = contributions_.find(time);
+    if (iter == contributions_.end())
+        return;
+    for (auto &pair_voxel : iter->second.voxels)
+    {
+        VoxelKey region_key = ToRegion(pair_voxel.first);
+        auto &voxels = regions_[region_key].voxels;
+        Voxel &voxel = voxels[pair_voxel.first];
+        voxel.num -= pair_voxel.second.num;
+        voxel.num_ground -= pair_voxel.second.num_ground;
+        voxel.sum -= pair_voxel.second.sum;
+        if (voxel.num <= 0)
+        {
+            voxels.erase(pair_voxel.first);
+        }
+        // an emptied region is kept, so its id stays valid for deletion
+        changed_regions_.insert(region_key);
+    }
+    contributions_.erase(iter);
+}
+
+bool VoxelMap::Contains(double time, SE3d &pose)
+{
+    auto iter = contributions_.find(time);
+    if (iter == contributions_.end())
+        return false;
+    pose = iter->second.pose;
+    return true;
+}
+
+void VoxelMap::ToCloud(const Region &region, PointRGBCloud &out)
+{
+    for (auto &pair_voxel : region.voxels)
+    {
+        const Voxel &voxel = pair_voxel.second;
+        Vector3d centroid = voxel.sum / voxel.num;
+        PointRGB point_color;
+        point_color.x = centroid.x();
+        point_color.y = centroid.y();
+        point_color.z = centroid.z();
+        bool ground = voxel.num_ground * 2 > voxel.num;
+        point_color.r = ground ? 255 : 0;
+        point_color.g = ground ? 0 : 255;
+        point_color.b = ground ? 255 : 0;
+        out.push_back(point_color);
+    }
+}
+
+PointRGBCloud VoxelMap::GetAll()
+{
+    PointRGBCloud out;
+    for (auto &pair_region : regions_)
+    {
+        ToCloud(pair_region.second, out);
+    }
+    return out;
+}
+
+// pointclouds of regions changed since the last call, key is the id of region, empty means deleted
+std::map<int, PointRGBCloud> VoxelMap::GetChanges()
+{
+    std::map<int, PointRGBCloud> changes;
+    for (auto &region_key : changed_regions_)
+    {
+        auto &region = regions_[region_key];
+        ToCloud(region, changes[region.id]);
+    }
+    changed_regions_.clear();
+    return changes;
+}
+
+} // namespace lvio_fusion
@@ -1,6 +1,7 @@
 #include "lvio_fusion/adapt/agent.h"
 #include "lvio_fusion/common.h"
 #include "lvio_fusion/estimator.h"
+#include "lvio_fusion/lidar/parser.h"
 #include "lvio_fusion/map.h"
 #include "object_detector/BoundingBoxes.h"
 #include "parameters.h"
@@ -167,13 +168,60 @@ void sync_process()
     }
 }
 
+// field names differ between drivers, e.g. time of velodyne and t(ns) of ouster
+lidar::FieldLayout to_field_layout(const sensor_msgs::PointCloud2 &msg)
+{
+    lidar::FieldLayout layout;
+    layout.point_step = msg.point_step;
+    layout.row_step = msg.row_step;
+    for (auto &field : msg.fields)
+    {
+        lidar::Field *target = nullptr;
+        double scale = 1;
+        if (field.name == "x")
+            target = &layout.x;
+        else if (field.name == "y")
+            target = &layout.y;
+        else if (field.name == "z")
+            target = &layout.z;
+        else if (field.name == "intensity")
+            target = &layout.intensity;
+        else if (field.name == "ring")
+            target = &layout.ring;
+        else if (field.name == "time")
+            target = &layout.time;
+        else if (field.name == "t")
+        {
+            target = &layout.time;
+            scale = 1e-9;
+        }
+        if (target)
+        {
+            target->type = (lidar::FieldType)field.datatype;
+            target->offset = field.offset;
+            target->scale = scale;
+        }
+    }
+    return layout;
+}
+
 void lidar_callback(const sensor_msgs::PointCloud2ConstPtr &lidar_msg)
 {
     double t = lidar_msg->header.stamp.toSec();
-    Point3Cloud point_cloud;
-    pcl::fromROSMsg(*lidar_msg, point_cloud);
-    Point3Cloud::Ptr laser_cloud_in_ptr(new Point3Cloud(point_cloud));
-    estimator->InputPointCloud(t, laser_cloud_in_ptr);
+    if (lidar_msg->is_bigendian)
+    {
+        ROS_WARN("big endian pointcloud is not supported");
+        return;
+    }
+    // parse the raw buffer directly, intensity, ring and time are filled if the driver publishes them
+    PointICloud::Ptr laser_cloud_in_ptr(new PointICloud);
+    lidar::FieldLayout layout = to_field_layout(*lidar_msg);
+    if (!lidar::ParsePoints(lidar_msg->data.data(), lidar_msg->data.size(), lidar_msg->width, lidar_msg->height, layout, *laser_cloud_in_ptr))
+    {
+        ROS_WARN("pointcloud without x, y, z or with fields out of its buffer is dropped");
+        return;
+    }
+    estimator->InputPointCloud(t, laser_cloud_in_ptr, layout.time.type != lidar::FieldType::None, layout.ring.type != lidar::FieldType::None);
 }
 
 void imu_callback(const sensor_msgs::ImuConstPtr &imu_msg)
@@ -209,11 +257,6 @@ void navsat_callback(const sensor_msgs::NavSatFixConstPtr &navsat_msg)
     estimator->InputNavSat(t, xyz[0], xyz[1], xyz[2], pos_accuracy);
 }
 
-void tf_timer_callback(const ros::TimerEvent &timer_event)
-{
-    publish_tf(estimator, timer_event.current_real.toSec() - delta_time);
-}
-
 void pc_timer_callback(const ros::TimerEvent &timer_event)
 {
     publish_point_cloud(estimator, timer_event.current_real.toSec() - delta_time);
@@ -227,6 +270,7 @@ void od_timer_callback(const ros::TimerEvent &timer_event)
 void navsat_timer_callback(const ros::TimerEvent &timer_event)
 {
     publish_navsat(estimator, timer_event.current_real.toSec() - delta_time);
+    publish_navsat_tf(timer_event.current_real.toSec() - delta_time);
 }
 
 // For non-blocking keyboard inputs
@@ -338,7 +382,7 @@ int main(int argc, char **argv)
     ROS_WARN("waiting for images...");
 
     register_pub(n);
-    ros::Timer tf_timer = n.createTimer(ros::Duration(0.0001), tf_timer_callback);
+    estimator->propagator->Subscribe(publish_tf);
     ros::Timer od_timer = n.createTimer(ros::Duration(1), od_timer_callback);
     ros::Timer pc_timer;
     ros::Timer navsat_timer;
@@ -1,110 +1,151 @@
 #include "visualization.h"
+#include "lvio_fusion/lidar/lidar.h"
 #include "lvio_fusion/map.h"
 
 #include <pcl_conversions/pcl_conversions.h>
 
 ros::Publisher pub_path;
+ros::Publisher pub_path_changes;
 ros::Publisher pub_navsat;
 ros::Publisher pub_points_cloud;
+ros::Publisher pub_points_cloud_regions;
 ros::Publisher pub_car_model;
-nav_msgs::Path path, navsat_path;
+ros::Publisher pub_propagate;
+nav_msgs::Path navsat_path;
 
 void register_pub(ros::NodeHandle &n)
 {
     pub_path = n.advertise<nav_msgs::Path>("path", 1000);
+    pub_path_changes = n.advertise<nav_msgs::Path>("path_changes", 1000);
     pub_navsat = n.advertise<nav_msgs::Path>("navsat_path", 1000);
     pub_points_cloud = n.advertise<sensor_msgs::PointCloud2>("point_cloud", 1000);
+    pub_points_cloud_regions = n.advertise<visualization_msgs::MarkerArray>("point_cloud_regions", 1000);
     pub_car_model = n.advertise<visualization_msgs::Marker>("car_model", 1000);
+    pub_propagate = n.advertise<nav_msgs::Odometry>("imu_propagate", 1000);
 }
 
+geometry_msgs::PoseStamped to_pose_stamped(double time, const SE3d &pose)
+{
+    geometry_msgs::PoseStamped pose_stamped;
+    pose_stamped.header.stamp = ros::Time(time);
+    pose_stamped.header.frame_id = "world";
+    pose_stamped.pose.position.x = pose.translation().x();
+    pose_stamped.pose.position.y = pose.translation().y();
+    pose_stamped.pose.position.z = pose.translation().z();
+    pose_stamped.pose.orientation.w = pose.unit_quaternion().w();
+    pose_stamped.pose.orientation.x = pose.unit_quaternion().x();
+    pose_stamped.pose.orientation.y = pose.unit_quaternion().y();
+    pose_stamped.pose.orientation.z = pose.unit_quaternion().z();
+    return pose_stamped;
+}
+
+// publish the recent path and the keyframes whose poses are changed since the last time
 void publish_odometry(Estimator::Ptr estimator, double time)
 {
     if (estimator->frontend->status == FrontendStatus::TRACKING_GOOD)
     {
-        path.poses.clear();
-        for (auto frame : lvio_fusion::Map::Instance().keyframes)
+        nav_msgs::Path path;
+        for (auto pair_kf : estimator->trajectory->GetRecent())
         {
-            auto pose = frame.second->pose;
-            geometry_msgs::PoseStamped pose_stamped;
-            pose_stamped.header.stamp = ros::Time(frame.first);
-            pose_stamped.header.frame_id = "world";
-            pose_stamped.pose.position.x = pose.translation().x();
-            pose_stamped.pose.position.y = pose.translation().y();
-            pose_stamped.pose.position.z = pose.translation().z();
-            pose_stamped.pose.orientation.w = pose.unit_quaternion().w();
-            pose_stamped.pose.orientation.x = pose.unit_quaternion().x();
-            pose_stamped.pose.orientation.y = pose.unit_quaternion().y();
-            pose_stamped.pose.orientation.z = pose.unit_quaternion().z();
+            auto pose_stamped = to_pose_stamped(pair_kf.first, pair_kf.second->pose);
             path.poses.push_back(pose_stamped);
-            if (frame.second->loop_closure)
+            if (pair_kf.second->loop_closure)
             {
-                auto position = frame.second->loop_closure->frame_old->pose.translation();
-                geometry_msgs::PoseStamped pose_stamped_loop;
-                pose_stamped_loop.header.stamp = ros::Time(frame.first);
-                pose_stamped_loop.header.frame_id = "world";
-                pose_stamped_loop.pose.position.x = position.x();
-                pose_stamped_loop.pose.position.y = position.y();
-                pose_stamped_loop.pose.position.z = position.z();
-                path.poses.push_back(pose_stamped_loop);
+                SE3d pose_old(pair_kf.second->pose.so3(), pair_kf.second->loop_closure->frame_old->pose.translation());
+                path.poses.push_back(to_pose_stamped(pair_kf.first, pose_old));
                 path.poses.push_back(pose_stamped);
             }
         }
         path.header.stamp = ros::Time(time);
         path.header.frame_id = "world";
         pub_path.publish(path);
+
+        nav_msgs::Path path_changes;
+        for (auto pair_kf : estimator->trajectory->GetChanges())
+        {
+            path_changes.poses.push_back(to_pose_stamped(pair_kf.first, pair_kf.second->pose));
+        }
+        if (!path_changes.poses.empty())
+        {
+            path_changes.header.stamp = ros::Time(time);
+            path_changes.header.frame_id = "world";
+            pub_path_changes.publish(path_changes);
+        }
     }
 }
 
+// publish new navsat points, the path keeps the latest ones only
 void publish_navsat(Estimator::Ptr estimator, double time)
 {
+    static const int max_navsat_poses = 1000;
     auto navsat = Navsat::Get();
     static double head = 0;
     static int i = 0;
     if (navsat->initialized)
     {
-        auto iter = navsat->raw.lower_bound(head);
-        while (++iter != navsat->raw.end())
+        auto iter = navsat->raw.upper_bound(head);
+        for (; iter != navsat->raw.end(); iter++)
         {
+            head = iter->first;
             if (++i % 100 == 0)
             {
-                geometry_msgs::PoseStamped pose_stamped;
                 Vector3d point = navsat->GetPoint(iter->first);
-                pose_stamped.header.stamp = ros::Time(iter->first);
-                pose_stamped.header.frame_id = "world";
-                pose_stamped.pose.position.x = point.x();
-                pose_stamped.pose.position.y = point.y();
-                pose_stamped.pose.position.z = point.z();
-                navsat_path.poses.push_back(pose_stamped);
+                navsat_path.poses.push_back(to_pose_stamped(iter->first, SE3d(SO3d(), point)));
             }
         }
-        head = (--iter)->first;
+        if (navsat_path.poses.size() > max_navsat_poses)
+        {
+            navsat_path.poses.erase(navsat_path.poses.begin(), navsat_path.poses.end() - max_navsat_poses);
+        }
         navsat_path.header.stamp = ros::Time(time);
         navsat_path.header.frame_id = "world";
         pub_navsat.publish(navsat_path);
     }
 }
 
-void publish_tf(Estimator::Ptr estimator, double time)
+// called by the propagator at imu rate
+void publish_tf(const imu::Odometry &odometry)
 {
     static tf::TransformBroadcaster br;
     tf::Transform transform;
     tf::Quaternion tf_q;
     tf::Vector3 tf_t;
     // base_link
-    if (estimator->frontend->status == FrontendStatus::TRACKING_GOOD)
-    {
-        SE3d pose = estimator->frontend->current_frame->pose;
-        Quaterniond pose_q = pose.unit_quaternion();
-        Vector3d pose_t = pose.translation();
-        tf_q.setValue(pose_q.w(), pose_q.x(), pose_q.y(), pose_q.z());
-        tf_t.setValue(pose_t.x(), pose_t.y(), pose_t.z());
-        transform.setOrigin(tf_t);
-        transform.setRotation(tf_q);
-        br.sendTransform(tf::StampedTransform(transform, ros::Time(time), "world", "base_link"));
-    }
-    // navsat
+    Quaterniond pose_q = odometry.pose.unit_quaternion();
+    Vector3d pose_t = odometry.pose.translation();
+    tf_q.setValue(pose_q.x(), pose_q.y(), pose_q.z(), pose_q.w());
+    tf_t.setValue(pose_t.x(), pose_t.y(), pose_t.z());
+    transform.setOrigin(tf_t);
+    transform.setRotation(tf_q);
+    br.sendTransform(tf::StampedTransform(transform, ros::Time(odometry.time), "world", "base_link"));
+
+    nav_msgs::Odometry msg;
+    msg.header.stamp = ros::Time(odometry.time);
+    msg.header.frame_id = "world";
+    msg.child_frame_id = "base_link";
+    msg.pose.pose.position.x = pose_t.x();
+    msg.pose.pose.position.y = pose_t.y();
+    msg.pose.pose.position.z = pose_t.z();
+    msg.pose.pose.orientation.w = pose_q.w();
+    msg.pose.pose.orientation.x = pose_q.x();
+    msg.pose.pose.orientation.y = pose_q.y();
+    msg.pose.pose.orientation.z = pose_q.z();
+    msg.twist.twist.linear.x = odometry.velocity.x();
+    msg.twist.twist.linear.y = odometry.velocity.y();
+    msg.twist.twist.linear.z = odometry.velocity.z();
+    pub_propagate.publish(msg);
+    if (odometry.latency > 1e-2)
+        ROS_WARN("propagate latency: %f seconds", odometry.latency);
+}
+
+void publish_navsat_tf(double time)
+{
+    static tf::TransformBroadcaster br;
     if (Navsat::Num() && Navsat::Get()->initialized)
     {
+        tf::Transform transform;
+        tf::Quaternion tf_q;
+        tf::Vector3 tf_t;
         double *tf_data = Navsat::Get()->extrinsic.data();
         tf_q.setValue(tf_data[0], tf_data[1], tf_data[2], tf_data[3]);
         tf_t.setValue(tf_data[4], tf_data[5], tf_data[6]);
@@ -114,13 +155,62 @@ void publish_tf(Estimator::Ptr estimator, double time)
     }
 }
 
+visualization_msgs::Marker to_marker(const PointRGBCloud &points, const std::string &ns, int id, double time)
+{
+    visualization_msgs::Marker marker;
+    marker.header.stamp = ros::Time(time);
+    marker.header.frame_id = "world";
+    marker.ns = ns;
+    marker.id = id;
+    marker.type = visualization_msgs::Marker::POINTS;
+    marker.action = points.empty() ? visualization_msgs::Marker::DELETE : visualization_msgs::Marker::ADD;
+    marker.pose.orientation.w = 1;
+    marker.scale.x = marker.scale.y = Lidar::Get()->resolution;
+    for (auto &point : points)
+    {
+        geometry_msgs::Point p;
+        p.x = point.x;
+        p.y = point.y;
+        p.z = point.z;
+        std_msgs::ColorRGBA color;
+        color.r = point.r / 255.0;
+        color.g = point.g / 255.0;
+        color.b = point.b / 255.0;
+        color.a = 1;
+        marker.points.push_back(p);
+        marker.colors.push_back(color);
+    }
+    return marker;
+}
+
+// only changed regions are published as markers, rviz replaces them by id
 void publish_point_cloud(Estimator::Ptr estimator, double time)
 {
-    sensor_msgs::PointCloud2 ros_cloud;
-    pcl::toROSMsg(estimator->mapping->GetGlobalMap(), ros_cloud);
-    ros_cloud.header.stamp = ros::Time(time);
-    ros_cloud.header.frame_id = "world";
-    pub_points_cloud.publish(ros_cloud);
+    visualization_msgs::MarkerArray markers;
+    for (auto &pair_region : estimator->mapping->GetGlobalMapChanges())
+    {
+        markers.markers.push_back(to_marker(pair_region.second, "point_cloud", pair_region.first, time));
+    }
+    // keyframes which are not finalized are shown as a transient layer until they are in the global map
+    PointRGBCloud active_points;
+    if (estimator->mapping->GetActiveMapChange(active_points))
+    {
+        markers.markers.push_back(to_marker(active_points, "active_point_cloud", 0, time));
+    }
+    if (!markers.markers.empty())
+    {
+        pub_points_cloud_regions.publish(markers);
+    }
+
+    // the whole map is only for export
+    if (pub_points_cloud.getNumSubscribers() > 0)
+    {
+        sensor_msgs::PointCloud2 ros_cloud;
+        pcl::toROSMsg(estimator->mapping->GetGlobalMap(), ros_cloud);
+        ros_cloud.header.stamp = ros::Time(time);
+        ros_cloud.header.frame_id = "world";
+        pub_points_cloud.publish(ros_cloud);
+    }
 }
 
 void publish_car_model(Estimator::Ptr estimator, double time)
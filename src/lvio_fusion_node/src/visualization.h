@@ -28,7 +28,9 @@ void publish_navsat(Estimator::Ptr estimator, double time);
 
 void publish_point_cloud(Estimator::Ptr estimator, double time);
 
-void publish_tf(Estimator::Ptr estimator, double time);
+void publish_tf(const imu::Odometry &odometry);
+
+void publish_navsat_tf(double time);
 
 void publish_car_model(Estimator::Ptr estimator, double time);
 